@@ -1,14 +1,38 @@
-#include "Arduino.h"
 #include "RF24SN.h"
 
+// Scale factors for the decimals of fixed point values
+static const float decimalScales[] = {1.0f, 10.0f, 100.0f, 1000.0f, 10000.0f, 100000.0f, 1000000.0f, 10000000.0f};
+
 RF24SN::RF24SN(RF24* radio, RF24Network* network, RF24SNConfig* config, messageHandler onMessageHandler){
 	//initialize private variables
 	_radio = radio;
 	_network = network;
 	_config = config;
 	_onMessageHandler = onMessageHandler;
+	_rxBuffer = _nodeRxBuffer;
+	_rxBufferSize = RF24SN_RX_BUFFER_SIZE;
+	_lastHandle = RF24SN_INVALID_HANDLE;
+	_nextSentValue = 0;
+	_nextReceivedValue = 0;
+	_nextRttEstimate = 0;
+	_keepAliveInterval = 0;
+	_nextSequence = 0;
+	_nextSequenceWindow = 0;
+	_lastBaseTx = 0;
+	_sleepInterval = 0;
+	_wakeWindow = 0;
+	_asleep = false;
+	_sleptAt = 0;
+	_windowStart = 0;
+	_radioOnSince = 0;
+	_topicCache = NULL;
+	_idle = NULL;
+	_topicCacheSession = 0;
+	_topicCacheValid = false;
+	_topicCacheChecked = false;
 #ifdef RF24SN_HAS_LEDS
 	_ledFlags = 0x00;
+	_ledsLitAt = 0;
 #endif
 }
 
@@ -27,31 +51,115 @@ void RF24SN::begin(){
 	_radio->setDataRate(_config->radioDatarate);
 	_radio->setPALevel(_config->radioPaLevel);
 	_radio->setAutoAck(true);
+	_radioOnSince = millis();
+	_windowStart = millis();
 }
 
 bool RF24SN::hasTimedout(uint32_t from, uint32_t period){
 	return ((uint32_t)(millis() - from)) >= period;
 }
 
+uint32_t RF24SN::timeLeft(uint32_t from, uint32_t period){
+	uint32_t elapsed = millis() - from;
+	return elapsed >= period ? 0 : period - elapsed;
+}
+
 byte RF24SN::subscribe(const char* topic){
 	byte response = RF24SN_RSP_FAILED;
 	RF24SNSubscribeRequest sendPacket;
-	if(strlen(topic) > RF24SN_TOPIC_LENGTH){
+	// The name must leave room for its terminator
+	if(strlen(topic) >= RF24SN_TOPIC_LENGTH){
 		return RF24SN_RSP_FAILED;
 	}
 	strcpy(sendPacket.topicName, topic);
-	sendPacket.topicName[strlen(topic)] = '\0'; // TODO is this required?
+	if(_topicCache != NULL){
+		if(!_topicCacheChecked){
+			checkTopicCache();
+		}
+		byte cachedId = findCachedTopic(sendPacket.topicName);
+		if(cachedId != (byte)RF24SN_RSP_FAILED){
+			IF_RF24SN_DEBUG(Serial.print(F("Sub cached ")); Serial.println(sendPacket.topicName););
+			return cachedId;
+		}
+	}
 	IF_RF24SN_DEBUG(Serial.print(F("Sub ")); Serial.println(sendPacket.topicName););
 	RF24SNSubscribeResponse responsePacket;
+	// Gateways without sessions only send the topic id
+	responsePacket.session = 0;
 	bool gotResponse = sendRequest(_config->baseNodeAddress, RF24SN_SUBSCRIBE, &sendPacket, sizeof(RF24SNSubscribeRequest), &responsePacket, sizeof(RF24SNSubscribeResponse), 5);
-	if(gotResponse){
+	// The receive buffer still holds the frame that answered the request
+	if(gotResponse && _rxHeader.type == RF24SN_SUBNACK){
+		IF_RF24SN_DEBUG(Serial.println(F("SUBNACK")));
+	}
+	else if(gotResponse){
 		response = responsePacket.topicId;
+		cacheTopic(sendPacket.topicName, responsePacket);
 	}else{
 		IF_RF24SN_DEBUG(Serial.println(F("NO SUBACK")));
 	}
 	return response;
 }
 
+bool RF24SN::subscribeMany(const char* const* topics, uint8_t count, byte* topicIds){
+	if(count > RF24SN_MAX_SUBSCRIBE_MANY){
+		return false;
+	}
+	if(_topicCache != NULL && !_topicCacheChecked){
+		checkTopicCache();
+	}
+
+	// Pack the names that are not cached one after the other
+	char request[RF24SN_SUBSCRIBE_MANY_SIZE];
+	uint16_t requestLength = 0;
+	uint8_t requested[RF24SN_MAX_SUBSCRIBE_MANY];
+	uint8_t requestedCount = 0;
+	for(uint8_t idx = 0; idx < count; idx++){
+		uint16_t topicLength = strlen(topics[idx]);
+		// The gateway only keeps RF24SN_TOPIC_LENGTH - 1 characters
+		if(topicLength >= RF24SN_TOPIC_LENGTH){
+			topicIds[idx] = RF24SN_RSP_FAILED;
+			continue;
+		}
+		topicIds[idx] = findCachedTopic(topics[idx]);
+		if(topicIds[idx] != (byte)RF24SN_RSP_FAILED){
+			continue;
+		}
+		memcpy(request + requestLength, topics[idx], topicLength + 1);
+		requestLength += topicLength + 1;
+		requested[requestedCount++] = idx;
+	}
+	if(requestedCount == 0){
+		return true;
+	}
+	if(requestLength > MAX_PAYLOAD_SIZE){
+		return false;
+	}
+
+	IF_RF24SN_DEBUG(Serial.print(F("Sub many ")); Serial.println(requestedCount););
+	RF24SNSubscribeManyResponse response;
+	response.session = 0;
+	memset(response.topicIds, RF24SN_RSP_FAILED, sizeof(response.topicIds));
+	if(!sendRequest(_config->baseNodeAddress, RF24SN_SUBSCRIBE_MANY, request, requestLength, &response, sizeof(RF24SNSubscribeManyResponse), 5)){
+		IF_RF24SN_DEBUG(Serial.println(F("NO SUBACK")));
+		return false;
+	}
+	// The gateway has no room for this node, the requested ids stay failed
+	if(_rxHeader.type == RF24SN_SUBNACK){
+		IF_RF24SN_DEBUG(Serial.println(F("SUBNACK")));
+		return false;
+	}
+	for(uint8_t idx = 0; idx < requestedCount; idx++){
+		topicIds[requested[idx]] = response.topicIds[idx];
+		if(response.topicIds[idx] != (byte)RF24SN_RSP_FAILED){
+			RF24SNSubscribeResponse subscribed;
+			subscribed.topicId = response.topicIds[idx];
+			subscribed.session = response.session;
+			cacheTopic(topics[requested[idx]], subscribed);
+		}
+	}
+	return true;
+}
+
 bool RF24SN::publish(uint16_t nodeId, uint8_t sensorId, float value){
 	return publish(nodeId, sensorId, value, 1);
 }
@@ -66,98 +174,1059 @@ bool RF24SN::publish(uint16_t nodeId, uint8_t sensorId, float value, int retries
 	return gotResponse;
 }
 
+bool RF24SN::publish(uint16_t nodeId, uint8_t sensorId, float value, int retries, uint8_t encoding){
+	// The full value follows the packet for the retries, see fullValueRetry()
+	uint8_t sendPacket[sizeof(RF24SNTypedPacket) + sizeof(float)];
+	uint8_t len = encodeValue(nodeId, sensorId, value, encoding, *(RF24SNTypedPacket*)sendPacket);
+	if(len == 0){
+		return publish(nodeId, sensorId, value, retries);
+	}
+	memcpy(sendPacket + len, &value, sizeof(float));
+	bool gotResponse = sendRequest(nodeId, RF24SN_PUBLISH_TYPED, sendPacket, len, NULL, 0, retries);
+	if(!gotResponse){
+		IF_RF24SN_DEBUG(Serial.println(F("NO PUBACK")));
+		// The receiver might not have the value the next delta would be based on
+		RF24SNValueHistory* sent = findValueHistory(_sentValues, _nextSentValue, nodeId, sensorId, false);
+		if(sent != NULL){
+			sent->hasValue = false;
+		}
+	}
+	return gotResponse;
+}
 
-//send the packet to base, wait for ack-packet received back
-bool RF24SN::sendRequest(uint16_t nodeId, uint8_t messageType, const void* requestPacket, uint16_t reqLen, void* responsePacket, uint16_t resLen){
+bool RF24SN::publishBatch(uint16_t nodeId, const RF24SNPacket* packets, uint8_t count){
+	return publishBatch(nodeId, packets, count, 1);
+}
 
+bool RF24SN::publishBatch(uint16_t nodeId, const RF24SNPacket* packets, uint8_t count, int retries){
+	if(count == 0 || count > RF24SN_MAX_BATCH_SIZE){
+		return false;
+	}
+	bool gotResponse = sendRequest(nodeId, RF24SN_PUBLISH_BATCH, packets, count * sizeof(RF24SNPacket), NULL, 0, retries);
+	if(!gotResponse){
+		IF_RF24SN_DEBUG(Serial.println(F("NO PUBACK")));
+	}
+	return gotResponse;
+}
+
+uint8_t RF24SN::publishBatchAsync(uint16_t nodeId, const RF24SNPacket* packets, uint8_t count, int retries, requestHandler onComplete){
+	if(count == 0 || count > RF24SN_MAX_BATCH_SIZE){
+		return RF24SN_INVALID_HANDLE;
+	}
+	return sendRequestAsync(nodeId, RF24SN_PUBLISH_BATCH, packets, count * sizeof(RF24SNPacket), retries, onComplete);
+}
+
+uint8_t RF24SN::publishAsync(uint16_t nodeId, uint8_t sensorId, float value, requestHandler onComplete){
+	return publishAsync(nodeId, sensorId, value, 1, onComplete);
+}
+
+uint8_t RF24SN::publishAsync(uint16_t nodeId, uint8_t sensorId, float value, int retries, requestHandler onComplete){
+	RF24SNPacket sendPacket{sensorId, value};
+	return sendRequestAsync(nodeId, RF24SN_PUBLISH, &sendPacket, sizeof(RF24SNPacket), retries, onComplete);
+}
+
+uint8_t RF24SN::publishAsync(uint16_t nodeId, uint8_t sensorId, float value, int retries, uint8_t encoding, requestHandler onComplete){
+	RF24SNTypedPacket sendPacket;
+	uint8_t len = encodeValue(nodeId, sensorId, value, encoding, sendPacket);
+	if(len == 0){
+		return publishAsync(nodeId, sensorId, value, retries, onComplete);
+	}
+	uint8_t handle = sendRequestAsync(nodeId, RF24SN_PUBLISH_TYPED, &sendPacket, len, retries, onComplete);
+	// The full value follows the packet for the retries, see fullValueRetry()
+	RF24SNRequest* request = findRequest(handle);
+	if(request != NULL){
+		memcpy(request->payload + len, &value, sizeof(float));
+	}
+	return handle;
+}
+
+uint8_t RF24SN::subscribeAsync(const char* topic, requestHandler onComplete){
+	RF24SNSubscribeRequest sendPacket;
+	// The name must leave room for its terminator
+	if(strlen(topic) >= RF24SN_TOPIC_LENGTH){
+		return RF24SN_INVALID_HANDLE;
+	}
+	strcpy(sendPacket.topicName, topic);
+	IF_RF24SN_DEBUG(Serial.print(F("Sub a ")); Serial.println(topic););
+	return sendRequestAsync(_config->baseNodeAddress, RF24SN_SUBSCRIBE, &sendPacket, sizeof(RF24SNSubscribeRequest), 5, onComplete);
+}
+
+bool RF24SN::ping(uint16_t nodeId){
+	return sendRequest(nodeId, RF24SN_PINGREQ, NULL, 0, NULL, 0, 3);
+}
+
+uint8_t RF24SN::pingAsync(uint16_t nodeId, requestHandler onComplete){
+	return sendRequestAsync(nodeId, RF24SN_PINGREQ, NULL, 0, 3, onComplete);
+}
+
+void RF24SN::setTopicCache(RF24SNStorage* storage){
+	_topicCache = storage;
+	_topicCacheSession = 0;
+	_topicCacheValid = false;
+	_topicCacheChecked = false;
+	RF24SNTopicCacheHeader header;
+	if(storage != NULL
+		&& storage->read(0, &header, sizeof(RF24SNTopicCacheHeader))
+		&& header.magic == RF24SN_TOPIC_CACHE_MAGIC
+		&& header.topicLength == RF24SN_TOPIC_LENGTH
+		&& header.entryCount == RF24SN_TOPIC_CACHE_SIZE){
+		_topicCacheSession = header.session;
+	}
+}
+
+void RF24SN::checkTopicCache(void){
+	if(_topicCacheSession == 0){
+		// Nothing cached, the first subscribe starts the cache
+		_topicCacheChecked = true;
+		return;
+	}
+	RF24SNPingResponse response;
+	response.session = 0;
+	if(sendRequest(_config->baseNodeAddress, RF24SN_PINGREQ, NULL, 0, &response, sizeof(RF24SNPingResponse), 3)){
+		_topicCacheChecked = true;
+		_topicCacheValid = (response.session == _topicCacheSession);
+		IF_RF24SN_DEBUG(Serial.print(F("Tpc cache ")); Serial.println(_topicCacheValid););
+	}
+}
+
+byte RF24SN::findCachedTopic(const char* topic){
+	if(!_topicCacheValid){
+		return RF24SN_RSP_FAILED;
+	}
+	RF24SNTopicCacheEntry entry;
+	for(uint8_t idx = 0; idx < RF24SN_TOPIC_CACHE_SIZE; idx++){
+		uint16_t address = sizeof(RF24SNTopicCacheHeader) + idx * sizeof(RF24SNTopicCacheEntry);
+		if(_topicCache->read(address, &entry, sizeof(RF24SNTopicCacheEntry))
+			&& entry.topicName[0] != '\0'
+			&& strncmp(entry.topicName, topic, RF24SN_TOPIC_LENGTH) == 0){
+			return entry.topicId;
+		}
+	}
+	return RF24SN_RSP_FAILED;
+}
+
+void RF24SN::cacheTopic(const char* topic, const RF24SNSubscribeResponse& response){
+	if(_topicCache == NULL || response.session == 0){
+		return;
+	}
+	RF24SNTopicCacheEntry entry;
+	if(response.session != _topicCacheSession){
+		// The ids of another session mean nothing to the gateway, start over
+		memset(&entry, 0, sizeof(RF24SNTopicCacheEntry));
+		for(uint8_t idx = 0; idx < RF24SN_TOPIC_CACHE_SIZE; idx++){
+			_topicCache->write(sizeof(RF24SNTopicCacheHeader) + idx * sizeof(RF24SNTopicCacheEntry), &entry, sizeof(RF24SNTopicCacheEntry));
+		}
+		// The header goes last, an interrupted reset leaves an empty cache of the old session
+		RF24SNTopicCacheHeader header;
+		header.magic = RF24SN_TOPIC_CACHE_MAGIC;
+		header.topicLength = RF24SN_TOPIC_LENGTH;
+		header.entryCount = RF24SN_TOPIC_CACHE_SIZE;
+		header.session = response.session;
+		if(!_topicCache->write(0, &header, sizeof(RF24SNTopicCacheHeader))){
+			_topicCacheSession = 0;
+			_topicCacheValid = false;
+			return;
+		}
+		_topicCacheSession = response.session;
+	}
+	_topicCacheValid = true;
+	_topicCacheChecked = true;
+
+	// Update the entry of the topic, or take the first free one
+	int16_t freeAddress = -1;
+	for(uint8_t idx = 0; idx < RF24SN_TOPIC_CACHE_SIZE; idx++){
+		uint16_t address = sizeof(RF24SNTopicCacheHeader) + idx * sizeof(RF24SNTopicCacheEntry);
+		if(!_topicCache->read(address, &entry, sizeof(RF24SNTopicCacheEntry))){
+			return;
+		}
+		if(entry.topicName[0] != '\0' && strncmp(entry.topicName, topic, RF24SN_TOPIC_LENGTH) == 0){
+			freeAddress = address;
+			break;
+		}
+		if(entry.topicName[0] == '\0' && freeAddress < 0){
+			freeAddress = address;
+		}
+	}
+	// A full cache keeps the topics that were subscribed first
+	if(freeAddress >= 0){
+		strncpy(entry.topicName, topic, RF24SN_TOPIC_LENGTH - 1);
+		entry.topicName[RF24SN_TOPIC_LENGTH - 1] = '\0';
+		entry.topicId = response.topicId;
+		_topicCache->write(freeAddress, &entry, sizeof(RF24SNTopicCacheEntry));
+	}
+}
+
+void RF24SN::setIdle(RF24SNIdle* idle){
+	_idle = idle;
+}
+
+void RF24SN::setKeepAliveInterval(uint32_t interval){
+	_keepAliveInterval = interval;
+	_lastBaseTx = millis();
+}
+
+void RF24SN::setDutyCycle(uint32_t sleepInterval, uint16_t wakeWindow){
+	_sleepInterval = sleepInterval;
+	_wakeWindow = wakeWindow;
+	if(_asleep){
+		RF24SN::wakeRadio();
+	}
+	RF24SN::announceDutyCycle();
+}
+
+void RF24SN::announceDutyCycle(void){
+	RF24SNPingRequest request;
+	request.sleepInterval = _sleepInterval;
+	request.wakeWindow = _wakeWindow;
+	// The ack keeps the radio on until the base node knows the window started
+	sendRequestAsync(_config->baseNodeAddress, RF24SN_PINGREQ, &request, sizeof(RF24SNPingRequest), 3, NULL);
+}
+
+void RF24SN::wakeRadio(void){
+	_radio->powerUp();
+	_asleep = false;
+	_radioOnSince = millis();
+	_windowStart = millis();
+	IF_RF24SN_DEBUG(Serial.println(F("Wake")););
+}
+
+void RF24SN::updateDutyCycle(void){
+	if(!_asleep){
+		uint32_t now = millis();
+		_stats.radioOnTime += now - _radioOnSince;
+		_radioOnSince = now;
+	}
+	if(_sleepInterval == 0){
+		return;
+	}
+	if(_asleep){
+		if(RF24SN::hasTimedout(_sleptAt, _sleepInterval)){
+			RF24SN::wakeRadio();
+			RF24SN::announceDutyCycle();
+		}
+		return;
+	}
+	if(!RF24SN::hasTimedout(_windowStart, _wakeWindow) || RF24SN::getDeferredAckTimeout() != RF24SN_NO_TIMEOUT){
+		return;
+	}
+	for(byte idx = 0 ; idx < RF24SN_MAX_PENDING_REQUESTS; idx++){
+		if(_requests[idx].handle != RF24SN_INVALID_HANDLE){
+			return;
+		}
+	}
+	IF_RF24SN_DEBUG(Serial.println(F("Sleep")););
+	_radio->powerDown();
+	_asleep = true;
+	_sleptAt = millis();
+}
+
+void RF24SN::checkKeepAlive(void){
+	if(_keepAliveInterval == 0 || !RF24SN::hasTimedout(_lastBaseTx, _keepAliveInterval)){
+		return;
+	}
+	IF_RF24SN_DEBUG(Serial.println(F("Keep alive")););
+	if(pingAsync(_config->baseNodeAddress, NULL) == RF24SN_INVALID_HANDLE){
+		// No free request slot, the requests in flight keep the node alive
+		_lastBaseTx = millis();
+	}
+}
+
+uint8_t RF24SN::requestStats(uint16_t nodeId, requestHandler onComplete){
+	return sendRequestAsync(nodeId, RF24SN_STATSREQ, NULL, 0, 3, onComplete);
+}
+
+const RF24SNStats& RF24SN::getStats(void){
+	return _stats;
+}
+
+void RF24SN::resetStats(void){
+	_stats = RF24SNStats();
+}
+
+bool RF24SN::isPending(uint8_t handle){
+	if(handle == RF24SN_INVALID_HANDLE){
+		return false;
+	}
+	for(byte idx = 0 ; idx < RF24SN_MAX_PENDING_REQUESTS; idx++){
+		if(_requests[idx].handle == handle){
+			return true;
+		}
+	}
+	return false;
+}
+
+void RF24SN::cancelRequest(uint8_t handle){
+	if(handle == RF24SN_INVALID_HANDLE){
+		return;
+	}
+	for(byte idx = 0 ; idx < RF24SN_MAX_PENDING_REQUESTS; idx++){
+		if(_requests[idx].handle == handle){
+			_requests[idx].handle = RF24SN_INVALID_HANDLE;
+		}
+	}
+}
+
+uint8_t RF24SN::sendRequestAsync(uint16_t nodeId, uint8_t messageType, const void* requestPacket, uint16_t reqLen, int retries, requestHandler onComplete){
+	if(reqLen > RF24SN_MAX_REQUEST_SIZE || retries < 1){
+		return RF24SN_INVALID_HANDLE;
+	}
+	for(byte idx = 0 ; idx < RF24SN_MAX_PENDING_REQUESTS; idx++){
+		RF24SNRequest& request = _requests[idx];
+		if(request.handle != RF24SN_INVALID_HANDLE){
+			continue;
+		}
+		// Skip the invalid handle when wrapping around
+		if(++_lastHandle == RF24SN_INVALID_HANDLE){
+			++_lastHandle;
+		}
+		request.handle = _lastHandle;
+		request.nodeId = nodeId;
+		request.messageType = messageType;
+		request.sequence = nextSequence();
+		if(reqLen > 0){
+			memcpy(request.payload, requestPacket, reqLen);
+		}
+		request.payloadLength = reqLen;
+		request.transmissionsLeft = retries > 255 ? 255 : retries;
+		request.transmissions = 0;
+		request.onComplete = onComplete;
+		transmitRequest(request);
+		return request.handle;
+	}
+	IF_RF24SN_DEBUG(Serial.println(F("Req mx")););
+	return RF24SN_INVALID_HANDLE;
+}
+
+void RF24SN::transmitRequest(RF24SNRequest& request){
 #ifdef RF24SN_HAS_LEDS
 	_ledFlags |= LEDF_FLASH_TX;
 	updateLeds();
 #endif
+	if(request.transmissions > 0){
+		_stats.retries++;
+		if(request.messageType == RF24SN_PUBLISH_TYPED){
+			uint8_t retryLen = fullValueRetry(request.nodeId, request.payload, request.payloadLength, request.payload);
+			if(retryLen > 0){
+				request.messageType = RF24SN_PUBLISH;
+				request.payloadLength = retryLen;
+			}
+		}
+	}
+	RF24NetworkHeader networkHeader(request.nodeId, request.messageType);
+	networkHeader.id = request.sequence;
+	request.transmissionsLeft--;
+	request.sentAt = millis();
+	request.timeout = getAckTimeout(request.nodeId, request.transmissions);
+	request.transmissions++;
+	// A failed write is handled the same as a missing ack, the request is resent after the timeout
+	writeFrame(networkHeader, request.payload, request.payloadLength);
+}
 
-	RF24NetworkHeader networkHeader(nodeId, messageType);
-	//this will be returned at the end. if no ack packet comes back, then "no packet" packet will be returned
-	if(!_network->write(networkHeader, requestPacket, reqLen)){
-		return false;
+RF24SNRequest* RF24SN::findRequest(uint8_t handle){
+	for(byte idx = 0 ; idx < RF24SN_MAX_PENDING_REQUESTS && handle != RF24SN_INVALID_HANDLE; idx++){
+		if(_requests[idx].handle == handle){
+			return &_requests[idx];
+		}
+	}
+	return NULL;
+}
+
+uint8_t RF24SN::fullValueRetry(uint16_t nodeId, const uint8_t* typedPacket, uint8_t len, uint8_t* packet){
+	uint8_t type = typedPacket[1] & 0x0F;
+	if(type != RF24SN_VALUE_DELTA8 && type != RF24SN_VALUE_DELTA16){
+		return 0;
+	}
+	RF24SNPacket fullPacket;
+	fullPacket.topicId = typedPacket[0];
+	memcpy(&fullPacket.value, typedPacket + len, sizeof(float));
+	memcpy(packet, &fullPacket, sizeof(RF24SNPacket));
+	// A float publish does not update the base on the receiver, it may be the old or the new value now
+	RF24SNValueHistory* sent = findValueHistory(_sentValues, _nextSentValue, nodeId, fullPacket.topicId, false);
+	if(sent != NULL){
+		sent->hasValue = false;
+	}
+	return sizeof(RF24SNPacket);
+}
+
+void RF24SN::checkPendingRequests(void){
+	for(byte idx = 0 ; idx < RF24SN_MAX_PENDING_REQUESTS; idx++){
+		RF24SNRequest& request = _requests[idx];
+		if(request.handle == RF24SN_INVALID_HANDLE || !RF24SN::hasTimedout(request.sentAt, request.timeout)){
+			continue;
+		}
+		if(request.transmissionsLeft > 0){
+			IF_RF24SN_DEBUG(Serial.print(F("Req rtx ")); Serial.println(request.handle, DEC););
+			transmitRequest(request);
+		}
+		else{
+			IF_RF24SN_DEBUG(Serial.print(F("Req t/o ")); Serial.println(request.handle, DEC););
+			_stats.timeouts++;
+			completeRequest(request, false, NULL, 0);
+		}
+	}
+}
+
+void RF24SN::completeRequest(RF24SNRequest& request, bool success, const void* response, uint16_t responseLength){
+	// Free the slot before notifying, so the handler can queue a new request
+	RF24SNRequest completed = request;
+	request.handle = RF24SN_INVALID_HANDLE;
+	if(!success && completed.messageType == RF24SN_PUBLISH_TYPED){
+		// The receiver might not have the value the next delta would be based on
+		RF24SNValueHistory* sent = findValueHistory(_sentValues, _nextSentValue, completed.nodeId, completed.payload[0], false);
+		if(sent != NULL){
+			sent->hasValue = false;
+		}
+	}
+	if(completed.messageType == RF24SN_SUBSCRIBE && success && responseLength >= sizeof(RF24SNSubscribeResponse)){
+		RF24SNSubscribeResponse subscribeResponse;
+		memcpy(&subscribeResponse, response, sizeof(RF24SNSubscribeResponse));
+		cacheTopic((const char*)completed.payload, subscribeResponse);
+	}
+	// A keep alive answered with another session means the gateway forgot this node
+	if(completed.messageType == RF24SN_PINGREQ && success && _topicCacheValid
+		&& completed.nodeId == _config->baseNodeAddress && responseLength >= sizeof(RF24SNPingResponse)){
+		RF24SNPingResponse pingResponse;
+		memcpy(&pingResponse, response, sizeof(RF24SNPingResponse));
+		if(pingResponse.session != _topicCacheSession){
+			_topicCacheValid = false;
+		}
+	}
+	onRequestComplete(completed, success, response, responseLength);
+}
+
+void RF24SN::onRequestComplete(const RF24SNRequest& request, bool success, const void* response, uint16_t responseLength){
+	if(request.onComplete != NULL){
+		request.onComplete(request, success, response, responseLength);
+	}
+}
+
+void RF24SN::handleAck(void){
+	for(byte idx = 0 ; idx < RF24SN_MAX_PENDING_REQUESTS; idx++){
+		RF24SNRequest& request = _requests[idx];
+		if(request.handle != RF24SN_INVALID_HANDLE
+			&& request.nodeId == _rxHeader.from_node
+			&& RF24SN_ACK_MATCHES(request.sequence, _rxHeader)
+			&& RF24SN::isAnswer(getAckType(request.messageType), _rxHeader.type)){
+
+			// The request handler might send a blocking request, which reuses the receive buffer
+			uint8_t response[RF24SN_MAX_RESPONSE_SIZE];
+			uint16_t responseLength = _rxLength < sizeof(response) ? _rxLength : sizeof(response);
+			memcpy(response, _rxBuffer, responseLength);
+			// Only an ack of the first transmission gives an unambiguous round trip time
+			if(request.transmissions == 1){
+				updateRtt(request.nodeId, millis() - request.sentAt);
+			}
+			// A refused subscribe is answered, but did not succeed
+			completeRequest(request, _rxHeader.type != RF24SN_SUBNACK, response, responseLength);
+			return;
+		}
+	}
+	RF24SN::swallowFrame();
+}
+
+uint16_t RF24SN::getAckTimeout(uint16_t nodeId, uint8_t attempt){
+	uint32_t timeout = RF24SN_INITIAL_RTO;
+	for(byte idx = 0 ; idx < RF24SN_MAX_RTT_PEERS; idx++){
+		if(_rttEstimates[idx].valid && _rttEstimates[idx].nodeId == nodeId){
+			timeout = (_rttEstimates[idx].srtt >> 3) + _rttEstimates[idx].rttvar;
+			break;
+		}
 	}
-	return waitForPacket(getAckType(networkHeader.type), responsePacket, resLen);
+	if(timeout < RF24SN_MIN_RTO){
+		timeout = RF24SN_MIN_RTO;
+	}
+
+	// Exponential backoff for retries
+	timeout <<= (attempt < 8 ? attempt : 8);
+	if(timeout > RF24SN_MAX_RTO){
+		timeout = RF24SN_MAX_RTO;
+	}
+
+	// Random jitter as to minimize repeated collisions.
+	return timeout + RF24SN_RANDOM(0, timeout / 4 + 1);
+}
+
+void RF24SN::updateRtt(uint16_t nodeId, uint32_t rtt){
+	byte bucket = 0;
+	while(bucket < RF24SN_RTT_BUCKETS - 1 && rtt >= ((uint32_t)8 << bucket)){
+		bucket++;
+	}
+	_stats.ackRtt[bucket]++;
+
+	if(rtt > RF24SN_MAX_RTO){
+		rtt = RF24SN_MAX_RTO;
+	}
+	RF24SNRttEstimate* estimate = NULL;
+	for(byte idx = 0 ; idx < RF24SN_MAX_RTT_PEERS; idx++){
+		if(_rttEstimates[idx].valid && _rttEstimates[idx].nodeId == nodeId){
+			estimate = &_rttEstimates[idx];
+			break;
+		}
+	}
+	if(estimate == NULL){
+		// Replace the estimates round robin
+		estimate = &_rttEstimates[_nextRttEstimate];
+		_nextRttEstimate = (_nextRttEstimate + 1) % RF24SN_MAX_RTT_PEERS;
+		estimate->nodeId = nodeId;
+		estimate->valid = true;
+		estimate->srtt = rtt << 3;
+		estimate->rttvar = rtt << 1;
+		return;
+	}
+
+	// Jacobson/Karels, srtt += (rtt - srtt) / 8 and rttvar += (|rtt - srtt| - rttvar) / 4
+	int32_t delta = (int32_t)rtt - (estimate->srtt >> 3);
+	estimate->srtt += delta;
+	if(delta < 0){
+		delta = -delta;
+	}
+	estimate->rttvar += delta - (estimate->rttvar >> 2);
+	IF_RF24SN_DEBUG(
+		Serial.print(F("RTO "));
+		Serial.println((estimate->srtt >> 3) + estimate->rttvar, DEC);
+	);
+}
+
+//send the packet to base, wait for ack-packet received back
+bool RF24SN::sendRequest(uint16_t nodeId, uint8_t messageType, const void* requestPacket, uint16_t reqLen, void* responsePacket, uint16_t resLen){
+	return sendRequest(nodeId, messageType, requestPacket, reqLen, responsePacket, resLen, 1);
 }
 
 //send the packet to base, wait for ack-packet received back and check it, optionally resent if ack does not match
 bool RF24SN::sendRequest(uint16_t nodeId, uint8_t messageType, const void* requestPacket, uint16_t reqLen, void* responsePacket, uint16_t resLen, int retries){
-	bool gotResponse = false;
+	// Every transmission uses the same sequence number, so the receiver can drop duplicates
+	uint16_t sequence = nextSequence();
 	//loop until no retires are left or until successfully acked.
-	for(int transmission = 1; (transmission <= retries) && !gotResponse ; transmission++){
-		gotResponse = sendRequest(nodeId, messageType, requestPacket, reqLen, responsePacket, resLen);
+	uint8_t retryPacket[sizeof(RF24SNPacket)];
+	for(int transmission = 0; transmission < retries; transmission++){
+#ifdef RF24SN_HAS_LEDS
+		_ledFlags |= LEDF_FLASH_TX;
+		updateLeds();
+#endif
+		if(transmission == 1 && messageType == RF24SN_PUBLISH_TYPED){
+			uint8_t retryLen = fullValueRetry(nodeId, (const uint8_t*)requestPacket, reqLen, retryPacket);
+			if(retryLen > 0){
+				messageType = RF24SN_PUBLISH;
+				requestPacket = retryPacket;
+				reqLen = retryLen;
+			}
+		}
+		RF24NetworkHeader networkHeader(nodeId, messageType);
+		networkHeader.id = sequence;
+		uint32_t sentAt = millis();
+		uint16_t timeout = getAckTimeout(nodeId, transmission);
+		if(transmission > 0){
+			_stats.retries++;
+		}
+		bool written = writeFrame(networkHeader, requestPacket, reqLen);
+		if(!written && transmission + 1 == retries){
+			break;
+		}
+		// A failed write is handled the same as a missing ack, it is resent after the backoff
+		if(waitForPacket(nodeId, sequence, getAckType(messageType), responsePacket, resLen, timeout) && written){
+			// Only an ack of the first transmission gives an unambiguous round trip time
+			if(transmission == 0){
+				updateRtt(nodeId, millis() - sentAt);
+			}
+			return true;
+		}
 	}
-	return gotResponse;
+	_stats.timeouts++;
+	return false;
 }
 
 
 uint8_t RF24SN::getAckType(uint8_t request){
-	if(request == RF24SN_PUBLISH){
+	if(request == RF24SN_PUBLISH || request == RF24SN_PUBLISH_BATCH || request == RF24SN_PUBLISH_TYPED
+		|| request == RF24SN_PUBLISH_TOPIC){
 		return RF24SN_PUBACK;
 	}
-	else if(request == RF24SN_SUBSCRIBE){
+	else if(request == RF24SN_SUBSCRIBE || request == RF24SN_SUBSCRIBE_MANY){
 		return RF24SN_SUBACK;
 	}
 	else if(request == RF24SN_PINGREQ){
 		return RF24SN_PINGRES;
 	}
+	else if(request == RF24SN_STATSREQ){
+		return RF24SN_STATSRES;
+	}
 	return 0;
 }
 
+bool RF24SN::isAnswer(uint8_t ackType, uint8_t frameType){
+	return frameType == ackType || (ackType == RF24SN_SUBACK && frameType == RF24SN_SUBNACK);
+}
+
+
+const RF24SN::frameHandler RF24SN::frameHandlers[RF24SN_MSG_TYPES] RF24SN_TABLE_ATTR = {
+	&RF24SN::handlePublishMessage, // RF24SN_PUBLISH
+	&RF24SN::handleAck, // RF24SN_PUBACK
+	NULL, NULL, NULL, NULL,
+	NULL, // RF24SN_SUBSCRIBE, handled by the gateway
+	&RF24SN::handleAck, // RF24SN_SUBACK
+	&RF24SN::handleAck, // RF24SN_SUBNACK
+	NULL,
+	&RF24SN::handlePingRequest, // RF24SN_PINGREQ
+	&RF24SN::handleAck, // RF24SN_PINGRES
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	&RF24SN::handlePublishBatchMessage, // RF24SN_PUBLISH_BATCH
+	&RF24SN::handlePublishTypedMessage, // RF24SN_PUBLISH_TYPED
+	&RF24SN::handleStatsRequest, // RF24SN_STATSREQ
+	&RF24SN::handleAck, // RF24SN_STATSRES
+	NULL, // RF24SN_SUBSCRIBE_MANY, handled by the gateway
+	&RF24SN::handlePublishTopicMessage // RF24SN_PUBLISH_TOPIC
+};
+
+
+void RF24SN::receiveFrame(void){
+	_rxLength = _network->read(_rxHeader, _rxBuffer, _rxBufferSize);
+	_rxBuffer[_rxLength] = '\0';
+	_stats.framesRx++;
+#ifdef RF24SN_HAS_LEDS
+	_ledFlags |= LEDF_FLASH_RX;
+	updateLeds();
+#endif
+}
+
+
+RF24SN::frameHandler RF24SN::getFrameHandler(uint8_t messageType){
+	frameHandler handler = NULL;
+	if(messageType >= RF24SN_FIRST_MSG_TYPE && messageType < RF24SN_FIRST_MSG_TYPE + RF24SN_MSG_TYPES){
+		RF24SN_READ_TABLE(handler, frameHandlers[messageType - RF24SN_FIRST_MSG_TYPE]);
+	}
+	return handler;
+}
+
 
 bool RF24SN::handleMessage(bool swallowInvalid){
-	RF24NetworkHeader header;
-	_network->peek(header);
-	if(header.type == RF24SN_PUBLISH){
-		RF24SN::handlePublishMessage();
+	uint8_t messageType = _rxHeader.type;
+	if(_rxHeader.id == 0 && RF24SN::getAckType(messageType) != 0){
+		// Only the first request after a restart of the node has sequence number 0,
+		// whatever its type, the window of the sequence numbers before is meaningless
+		RF24SN::restartSequence(_rxHeader.from_node);
+	}
+	if((messageType == RF24SN_PUBLISH || messageType == RF24SN_PUBLISH_BATCH || messageType == RF24SN_PUBLISH_TYPED
+		|| messageType == RF24SN_PUBLISH_TOPIC)
+		&& RF24SN::isDuplicate(_rxHeader.from_node, _rxHeader.id)){
+		// A retry of a publish that was already handled, the earlier ack was lost
+		IF_RF24SN_DEBUG(Serial.print(F("Dup ")); Serial.println(_rxHeader.id, DEC););
+		_stats.duplicates++;
+		queueAck(_rxHeader.from_node, RF24SN_PUBACK, _rxHeader.id, NULL, 0);
+		return true;
+	}
+	frameHandler handler = getFrameHandler(messageType);
+	if(handler != NULL){
+		(this->*handler)();
 		return true;
 	}
 	else if(swallowInvalid){
-		_network->read(header, NULL, 0);
+		RF24SN::swallowFrame();
 	}
 	return false;
 }
 
 
 void RF24SN::handlePublishMessage(void){
-	RF24NetworkHeader header;
+	// The message handler might send a blocking request, which reuses the receive buffer
+	RF24NetworkHeader header = _rxHeader;
 	RF24SNMessage message;
-	_network->read(header, &message.packet, sizeof(RF24SNPacket));
+	memcpy(&message.packet, _rxBuffer, sizeof(RF24SNPacket));
 	message.fromNode = header.from_node;
 	message.messageType = header.type;
+	message.topicName = NULL;
 	_onMessageHandler(message);
 
 	// Send back ack
-	delay(100);
-	RF24NetworkHeader responseHeader(header.from_node, RF24SN_PUBACK);
-	_network->write(responseHeader, NULL, 0);
+	acceptSequence(header.from_node, header.id);
+	queueAck(header.from_node, RF24SN_PUBACK, header.id, NULL, 0);
+}
+
+void RF24SN::handlePublishBatchMessage(void){
+	RF24NetworkHeader header = _rxHeader;
+	RF24SNPacket packets[RF24SN_MAX_BATCH_SIZE];
+	uint8_t count = _rxLength / sizeof(RF24SNPacket);
+	if(count > RF24SN_MAX_BATCH_SIZE){
+		count = RF24SN_MAX_BATCH_SIZE;
+	}
+	memcpy(packets, _rxBuffer, count * sizeof(RF24SNPacket));
+
+	RF24SNMessage message;
+	message.fromNode = header.from_node;
+	message.messageType = RF24SN_PUBLISH;
+	message.topicName = NULL;
+	for(uint8_t idx = 0 ; idx < count; idx++){
+		message.packet = packets[idx];
+		_onMessageHandler(message);
+	}
+
+	// A single ack for the whole batch
+	acceptSequence(header.from_node, header.id);
+	queueAck(header.from_node, RF24SN_PUBACK, header.id, NULL, 0);
+}
+
+void RF24SN::handlePublishTypedMessage(void){
+	RF24NetworkHeader header = _rxHeader;
+	const RF24SNTypedPacket& packet = *(const RF24SNTypedPacket*)_rxBuffer;
+	uint16_t len = _rxLength < sizeof(RF24SNTypedPacket) ? _rxLength : sizeof(RF24SNTypedPacket);
+
+	float value;
+	if(!decodeValue(header.from_node, packet, len, value)){
+		// Not acked, the sender retries with the full value as a float publish
+		IF_RF24SN_DEBUG(Serial.println(F("Typed inv")););
+		return;
+	}
+	RF24SNMessage message;
+	message.fromNode = header.from_node;
+	message.messageType = RF24SN_PUBLISH;
+	message.topicName = NULL;
+	message.packet.topicId = packet.topicId;
+	message.packet.value = value;
+	_onMessageHandler(message);
+
+	acceptSequence(header.from_node, header.id);
+	queueAck(header.from_node, RF24SN_PUBACK, header.id, NULL, 0);
+}
+
+void RF24SN::handlePublishTopicMessage(void){
+	RF24NetworkHeader header = _rxHeader;
+	const RF24SNTopicPacket& packet = *(const RF24SNTopicPacket*)_rxBuffer;
+	uint16_t len = _rxLength < sizeof(RF24SNTopicPacket) ? _rxLength : sizeof(RF24SNTopicPacket);
+	if(len < sizeof(packet.topicId) + sizeof(packet.value)){
+		IF_RF24SN_DEBUG(Serial.println(F("Topic inv")););
+		return;
+	}
+
+	char topicName[RF24SN_TOPIC_LENGTH];
+	uint16_t nameLength = len - sizeof(packet.topicId) - sizeof(packet.value);
+	memcpy(topicName, packet.topicName, nameLength);
+	topicName[nameLength] = '\0';
+
+	RF24SNMessage message;
+	message.fromNode = header.from_node;
+	message.messageType = RF24SN_PUBLISH;
+	message.packet.topicId = packet.topicId;
+	message.packet.value = packet.value;
+	message.topicName = topicName;
+	_onMessageHandler(message);
+
+	acceptSequence(header.from_node, header.id);
+	queueAck(header.from_node, RF24SN_PUBACK, header.id, NULL, 0);
+}
+
+uint8_t RF24SN::valueTag(float value){
+	const uint8_t* bytes = (const uint8_t*)&value;
+	uint8_t tag = 0;
+	for(uint8_t idx = 0 ; idx < sizeof(float); idx++){
+		tag = ((tag << 1) | (tag >> 7)) ^ bytes[idx];
+	}
+	return tag;
+}
+
+RF24SNValueHistory* RF24SN::findValueHistory(RF24SNValueHistory* history, uint8_t& next, uint16_t nodeId, uint8_t topicId, bool create){
+	for(uint8_t idx = 0 ; idx < RF24SN_MAX_DELTA_TOPICS; idx++){
+		if(history[idx].nodeId == nodeId && history[idx].topicId == topicId){
+			return &history[idx];
+		}
+	}
+	if(!create){
+		return NULL;
+	}
+	// Replace the entries round robin
+	RF24SNValueHistory* entry = &history[next];
+	next = (next + 1) % RF24SN_MAX_DELTA_TOPICS;
+	entry->nodeId = nodeId;
+	entry->topicId = topicId;
+	entry->hasValue = false;
+	return entry;
 }
 
+uint8_t RF24SN::encodeValue(uint16_t nodeId, uint8_t sensorId, float value, uint8_t encoding, RF24SNTypedPacket& packet){
+	uint8_t type = encoding & 0x0F;
+	uint8_t decimals = encoding >> 4;
+	if(type != RF24SN_VALUE_FIXED16 && type != RF24SN_VALUE_DELTA8 && type != RF24SN_VALUE_DELTA16){
+		decimals = 0;
+	}
+	float scale = decimalScales[decimals & 0x07];
+	RF24SNValueHistory* sent = findValueHistory(_sentValues, _nextSentValue, nodeId, sensorId, type != RF24SN_VALUE_FLOAT);
+
+	bool delta = type == RF24SN_VALUE_DELTA8 || type == RF24SN_VALUE_DELTA16;
+	if(delta && !sent->hasValue){
+		// Without a known base the value is sent in full
+		type = RF24SN_VALUE_FIXED16;
+		delta = false;
+	}
 
-bool RF24SN::waitForPacket(uint8_t type, void* responsePacket, uint16_t resLen){
+	float scaled = (delta ? value - sent->value : value) * scale;
+	int32_t raw = 0;
+	bool fits = scaled > -65536.0f && scaled < 65536.0f;
+	if(fits){
+		raw = (int32_t)(scaled + (scaled < 0 ? -0.5f : 0.5f));
+	}
+	uint8_t len = 2;
+	switch(type){
+		case RF24SN_VALUE_INT8:
+		case RF24SN_VALUE_DELTA8:
+			fits &= raw >= -128 && raw <= 127;
+			break;
+		case RF24SN_VALUE_UINT8:
+			fits &= raw >= 0 && raw <= 255;
+			break;
+		case RF24SN_VALUE_INT16:
+		case RF24SN_VALUE_FIXED16:
+		case RF24SN_VALUE_DELTA16:
+			fits &= raw >= -32768 && raw <= 32767;
+			break;
+		default:
+			fits = false;
+			break;
+	}
+	if(!fits){
+		// Sent as a normal float publish, which does not update the base on the receiver
+		if(sent != NULL){
+			sent->hasValue = false;
+		}
+		return 0;
+	}
+
+	packet.topicId = sensorId;
+	packet.encoding = type | (decimals << 4);
+	if(delta){
+		packet.value[len++ - 2] = valueTag(sent->value);
+	}
+	packet.value[len++ - 2] = raw & 0xFF;
+	if(type == RF24SN_VALUE_INT16 || type == RF24SN_VALUE_FIXED16 || type == RF24SN_VALUE_DELTA16){
+		packet.value[len++ - 2] = (raw >> 8) & 0xFF;
+	}
+
+	// Remember the value as the receiver will decode it
+	sent->value = (delta ? sent->value : 0) + raw / scale;
+	sent->hasValue = true;
+	return len;
+}
+
+bool RF24SN::decodeValue(uint16_t nodeId, const RF24SNTypedPacket& packet, uint16_t len, float& value){
+	uint8_t type = packet.encoding & 0x0F;
+	uint8_t decimals = packet.encoding >> 4;
+	if(len < 3 || decimals > 7){
+		return false;
+	}
+	const uint8_t* data = packet.value;
+	uint16_t dataLen = len - 2;
+	bool delta = type == RF24SN_VALUE_DELTA8 || type == RF24SN_VALUE_DELTA16;
+	RF24SNValueHistory* received = findValueHistory(_receivedValues, _nextReceivedValue, nodeId, packet.topicId, !delta);
+	if(delta){
+		// The delta must be based on the value we have
+		if(received == NULL || !received->hasValue || data[0] != valueTag(received->value)){
+			return false;
+		}
+		data++;
+		dataLen--;
+	}
+
+	int32_t raw;
+	switch(type){
+		case RF24SN_VALUE_INT8:
+		case RF24SN_VALUE_DELTA8:
+			raw = (int8_t)data[0];
+			break;
+		case RF24SN_VALUE_UINT8:
+			raw = data[0];
+			break;
+		case RF24SN_VALUE_INT16:
+		case RF24SN_VALUE_FIXED16:
+		case RF24SN_VALUE_DELTA16:
+			if(dataLen < 2){
+				return false;
+			}
+			raw = (int16_t)(data[0] | (data[1] << 8));
+			break;
+		default:
+			return false;
+	}
+
+	value = (delta ? received->value : 0) + raw / decimalScales[decimals];
+	received->value = value;
+	received->hasValue = true;
+	return true;
+}
+
+void RF24SN::handleStatsRequest(void){
+	queueAck(_rxHeader.from_node, RF24SN_STATSRES, _rxHeader.id, &_stats, sizeof(RF24SNStats));
+}
+
+void RF24SN::handlePingRequest(void){
+	queueAck(_rxHeader.from_node, RF24SN_PINGRES, _rxHeader.id, NULL, 0);
+}
+
+bool RF24SN::writeFrame(RF24NetworkHeader& header, const void* payload, uint16_t len){
+	if(_asleep){
+		RF24SN::wakeRadio();
+	}
+	// The base node expects an answer to be listened for, like after a wake up
+	_windowStart = millis();
+	_stats.framesTx++;
+	if(header.to_node == _config->baseNodeAddress){
+		_lastBaseTx = millis();
+	}
+	return _network->write(header, payload, len);
+}
+
+void RF24SN::swallowFrame(void){
+	_stats.swallowed++;
+}
+
+uint16_t RF24SN::nextSequence(void){
+	uint16_t sequence = _nextSequence++;
+	// 0 is only used for the first request after a restart
+	if(_nextSequence == 0){
+		_nextSequence = 1;
+	}
+	return sequence;
+}
+
+bool RF24SN::isDuplicate(uint16_t nodeId, uint16_t sequence){
+	for(byte idx = 0 ; idx < RF24SN_MAX_DEDUP_PEERS; idx++){
+		RF24SNSequenceWindow& window = _sequenceWindows[idx];
+		if(!window.valid || window.nodeId != nodeId){
+			continue;
+		}
+		int32_t age = (int16_t)(window.highest - sequence);
+		// Newer than anything received, or too old to tell which means the node restarted
+		if(age < 0 || age >= 32){
+			return false;
+		}
+		return (window.received & ((uint32_t)1 << age)) != 0;
+	}
+	return false;
+}
+
+void RF24SN::restartSequence(uint16_t nodeId){
+	for(byte idx = 0 ; idx < RF24SN_MAX_DEDUP_PEERS; idx++){
+		if(_sequenceWindows[idx].valid && _sequenceWindows[idx].nodeId == nodeId){
+			// This favours a restart over a late retry of the first request
+			_sequenceWindows[idx].valid = false;
+		}
+	}
+}
+
+void RF24SN::acceptSequence(uint16_t nodeId, uint16_t sequence){
+	RF24SNSequenceWindow* window = NULL;
+	for(byte idx = 0 ; idx < RF24SN_MAX_DEDUP_PEERS; idx++){
+		if(_sequenceWindows[idx].valid && _sequenceWindows[idx].nodeId == nodeId){
+			window = &_sequenceWindows[idx];
+			break;
+		}
+	}
+	if(window == NULL){
+		// Replace the windows round robin
+		window = &_sequenceWindows[_nextSequenceWindow];
+		_nextSequenceWindow = (_nextSequenceWindow + 1) % RF24SN_MAX_DEDUP_PEERS;
+		window->nodeId = nodeId;
+		window->valid = true;
+		window->highest = sequence;
+		window->received = 1;
+		return;
+	}
+
+	int32_t age = (int16_t)(window->highest - sequence);
+	if(age < 0 && age > -32){
+		// Slide the window up to the new sequence number
+		window->received = (window->received << -age) | 1;
+		window->highest = sequence;
+	}
+	else if(age >= 0 && age < 32){
+		window->received |= (uint32_t)1 << age;
+	}
+	else{
+		// Far outside the window, start a new window
+		window->highest = sequence;
+		window->received = 1;
+	}
+}
+
+void RF24SN::queueAck(uint16_t nodeId, uint8_t messageType, uint16_t sequence, const void* payload, uint16_t len){
+	if(len <= RF24SN_MAX_ACK_SIZE){
+		for(byte idx = 0 ; idx < RF24SN_MAX_DEFERRED_ACKS; idx++){
+			RF24SNDeferredAck& ack = _acks[idx];
+			if(ack.messageType == 0){
+				ack.nodeId = nodeId;
+				ack.messageType = messageType;
+				ack.sequence = sequence;
+				if(len > 0){
+					memcpy(ack.payload, payload, len);
+				}
+				ack.payloadLength = len;
+				ack.queuedAt = millis();
+				return;
+			}
+		}
+		IF_RF24SN_DEBUG(Serial.println(F("Ack mx")););
+	}
+	RF24NetworkHeader responseHeader(nodeId, messageType);
+	responseHeader.id = sequence;
+	writeFrame(responseHeader, payload, len);
+}
+
+void RF24SN::sendDeferredAcks(void){
+	for(byte idx = 0 ; idx < RF24SN_MAX_DEFERRED_ACKS; idx++){
+		RF24SNDeferredAck& ack = _acks[idx];
+		if(ack.messageType != 0 && RF24SN::hasTimedout(ack.queuedAt, RF24SN_ACK_DELAY)){
+#ifdef RF24SN_HAS_LEDS
+			_ledFlags |= LEDF_FLASH_TX;
+#endif
+			RF24NetworkHeader responseHeader(ack.nodeId, ack.messageType);
+			responseHeader.id = ack.sequence;
+			writeFrame(responseHeader, ack.payload, ack.payloadLength);
+			ack.messageType = 0;
+		}
+	}
+}
+
+uint32_t RF24SN::getDeferredAckTimeout(void){
+	uint32_t timeout = RF24SN_NO_TIMEOUT;
+	for(byte idx = 0 ; idx < RF24SN_MAX_DEFERRED_ACKS; idx++){
+		if(_acks[idx].messageType != 0){
+			uint32_t ackTimeout = RF24SN::timeLeft(_acks[idx].queuedAt, RF24SN_ACK_DELAY);
+			timeout = ackTimeout < timeout ? ackTimeout : timeout;
+		}
+	}
+	return timeout;
+}
+
+uint8_t RF24SN::freeRequests(void){
+	uint8_t count = 0;
+	for(byte idx = 0 ; idx < RF24SN_MAX_PENDING_REQUESTS; idx++){
+		if(_requests[idx].handle == RF24SN_INVALID_HANDLE){
+			count++;
+		}
+	}
+	return count;
+}
+
+bool RF24SN::waitForPacket(uint16_t nodeId, uint16_t sequence, uint8_t type, void* responsePacket, uint16_t resLen, uint16_t timeout){
 	//wait until response is available or until timeout
-	//the timeout period is random as to minimize repeated collisions.
 	unsigned long started_waiting_at = millis();
-	int random_wait_time = random(2000, 3000);
-
-	RF24NetworkHeader header;
 
-	while(!RF24SN::hasTimedout(started_waiting_at, random_wait_time)){
+	while(!RF24SN::hasTimedout(started_waiting_at, timeout)){
 		// Keep updating the network
 		_network->update();
+		sendDeferredAcks();
 
 		// Check if there is a packet available
+		if(!_network->available() && _idle != NULL){
+			// Sleep until a frame arrives, the timeout passes or an ack is due
+			uint32_t wait = RF24SN::timeLeft(started_waiting_at, timeout);
+			uint32_t ackTimeout = RF24SN::getDeferredAckTimeout();
+			_idle->wait(ackTimeout < wait ? ackTimeout : wait);
+			continue;
+		}
 		if(_network->available()){
-			_network->peek(header);
-#ifdef RF24SN_HAS_LEDS
-	_ledFlags |= LEDF_FLASH_RX;
-	updateLeds();
-#endif
-			if(header.type == type){
-				_network->read(header, responsePacket, resLen);
+			RF24SN::receiveFrame();
+			// Late acks of earlier requests do not match the sequence number
+			if(RF24SN::isAnswer(type, _rxHeader.type) && _rxHeader.from_node == nodeId && RF24SN_ACK_MATCHES(sequence, _rxHeader)){
+				if(responsePacket != NULL){
+					memcpy(responsePacket, _rxBuffer, _rxLength < resLen ? _rxLength : resLen);
+				}
 				return true;
 			}
 			else{
@@ -168,17 +1237,54 @@ bool RF24SN::waitForPacket(uint8_t type, void* responsePacket, uint16_t resLen){
 
 	return false;
 }
-void RF24SN::update(void){
-	_network->update();
-	if(_network->available()){
+
+uint32_t RF24SN::getUpdateTimeout(void){
+	if(_asleep){
+		return RF24SN::timeLeft(_sleptAt, _sleepInterval);
+	}
+	uint32_t timeout = RF24SN::getDeferredAckTimeout();
+	bool pending = (timeout != RF24SN_NO_TIMEOUT);
+	for(byte idx = 0 ; idx < RF24SN_MAX_PENDING_REQUESTS; idx++){
+		if(_requests[idx].handle != RF24SN_INVALID_HANDLE){
+			uint32_t requestTimeout = RF24SN::timeLeft(_requests[idx].sentAt, _requests[idx].timeout);
+			timeout = requestTimeout < timeout ? requestTimeout : timeout;
+			pending = true;
+		}
+	}
+	if(_keepAliveInterval != 0){
+		uint32_t keepAliveTimeout = RF24SN::timeLeft(_lastBaseTx, _keepAliveInterval);
+		timeout = keepAliveTimeout < timeout ? keepAliveTimeout : timeout;
+	}
+	if(_sleepInterval != 0){
+		// After the window the radio goes down as soon as nothing is pending anymore
+		uint32_t windowTimeout = RF24SN::timeLeft(_windowStart, _wakeWindow);
+		if(windowTimeout > 0 || !pending){
+			timeout = windowTimeout < timeout ? windowTimeout : timeout;
+		}
+	}
 #ifdef RF24SN_HAS_LEDS
-	_ledFlags |= LEDF_FLASH_RX;
-	updateLeds();
+	if(_ledFlags & LEDF_LIT){
+		uint32_t ledTimeout = RF24SN::timeLeft(_ledsLitAt, RF24SN_LED_FLASH_TIME);
+		timeout = ledTimeout < timeout ? ledTimeout : timeout;
+	}
 #endif
+	return timeout;
+}
 
+void RF24SN::update(void){
+	RF24SN::updateDutyCycle();
+	if(_asleep){
+		return;
+	}
+	_network->update();
+	while(_network->available()){
+		RF24SN::receiveFrame();
 		// We might receive a publish message while waiting for a ack
 		handleMessage(true);
 	}
+	sendDeferredAcks();
+	checkPendingRequests();
+	checkKeepAlive();
 #ifdef RF24SN_HAS_LEDS
 	updateLeds();
 #endif
@@ -193,9 +1299,14 @@ void RF24SN::updateLeds(void){
 		digitalWrite(PIN_LED_TX, HIGH);
 	}
 	if((_ledFlags & LEDF_FLASH_RX) || (_ledFlags & LEDF_FLASH_TX)){
-		delay(10);
+		// (Re)start the flash, the LEDs are switched off by a later update
 		_ledFlags &= ~LEDF_FLASH_RX;
 		_ledFlags &= ~LEDF_FLASH_TX;
+		_ledFlags |= LEDF_LIT;
+		_ledsLitAt = millis();
+	}
+	else if((_ledFlags & LEDF_LIT) && RF24SN::hasTimedout(_ledsLitAt, RF24SN_LED_FLASH_TIME)){
+		_ledFlags &= ~LEDF_LIT;
 		digitalWrite(PIN_LED_TX, LOW);
 		digitalWrite(PIN_LED_RX, LOW);
 	}
@@ -1,15 +1,51 @@
 #ifndef RF24SN_h
 #define RF24SN_h
 
+#if defined(ARDUINO)
 #include <Arduino.h>
+#else
+#include <stdlib.h>
+#include <string.h>
+#endif
 #include <stdint.h>
 #include "RF24.h"
 #include "RF24Network.h"
+#include "RF24SNStorage.h"
+
+// Host builds (RF24 on Linux or a simulated radio) get millis() and delay()
+// from the RF24 headers, the rest of the Arduino core used here is mapped below
+#if defined(ARDUINO)
+#define RF24SN_RANDOM(min, max) random(min, max)
+#else
+typedef uint8_t byte;
+#ifndef F
+#define F(x) (x)
+#endif
+#define RF24SN_RANDOM(min, max) ((min) + rand() % ((max) - (min)))
+#endif
 
 #if defined(PIN_LED_TX) && defined(PIN_LED_RX)
 #define RF24SN_HAS_LEDS
 #define LEDF_FLASH_TX 0x01
 #define LEDF_FLASH_RX 0x02
+#define LEDF_LIT 0x04
+
+// Time the LEDs stay lit after a frame was sent or received
+#ifndef RF24SN_LED_FLASH_TIME
+#define RF24SN_LED_FLASH_TIME 10
+#endif
+#endif
+
+// Version of the frames on air, see CHANGELOG.md for what changed between versions
+// 2: requests carry a sequence number in the RF24Network header id, acks echo it
+#define RF24SN_PROTOCOL_VERSION 2
+
+// Define RF24SN_LEGACY_ACKS for nodes that talk to a gateway of protocol version 1, which
+// does not echo the sequence number, acks are then matched by node and type only
+#ifdef RF24SN_LEGACY_ACKS
+#define RF24SN_ACK_MATCHES(sequence, header) ((void)(sequence), true)
+#else
+#define RF24SN_ACK_MATCHES(sequence, header) ((sequence) == (header).id)
 #endif
 
 // Max length for a topic
@@ -24,8 +60,128 @@
 #define IF_RF24SN_DEBUG(x)
 #endif
 
+// Maximum number of asynchronous requests that can be waiting for an ack
+// Every request keeps a full frame, AVR nodes rarely have more than a subscribe and a publish in flight
+#ifndef RF24SN_MAX_PENDING_REQUESTS
+#if defined(__AVR__)
+#define RF24SN_MAX_PENDING_REQUESTS 2
+#else
+#define RF24SN_MAX_PENDING_REQUESTS 4
+#endif
+#endif
+
+// Time to wait before sending an ack, gives the sender time to start listening
+#ifndef RF24SN_ACK_DELAY
+#define RF24SN_ACK_DELAY 5
+#endif
+
+// Maximum number of topics in a single bulk subscribe
+#ifndef RF24SN_MAX_SUBSCRIBE_MANY
+#define RF24SN_MAX_SUBSCRIBE_MANY 8
+#endif
+
+// Number of topic ids that can be kept in the topic cache
+#ifndef RF24SN_TOPIC_CACHE_SIZE
+#define RF24SN_TOPIC_CACHE_SIZE 4
+#endif
+
+// Maximum number of acks that can be waiting to be sent
+#ifndef RF24SN_MAX_DEFERRED_ACKS
+#define RF24SN_MAX_DEFERRED_ACKS 4
+#endif
+
+// Number of (node, topic) values remembered as base for delta encoded values, for sent and received values each
+#ifndef RF24SN_MAX_DELTA_TOPICS
+#if defined(__AVR__)
+#define RF24SN_MAX_DELTA_TOPICS 2
+#else
+#define RF24SN_MAX_DELTA_TOPICS 4
+#endif
+#endif
+
+// Ack timeout for nodes without a measured round trip time
+#ifndef RF24SN_INITIAL_RTO
+#define RF24SN_INITIAL_RTO 2000
+#endif
+
+// Lower bound for the ack timeout
+#ifndef RF24SN_MIN_RTO
+#define RF24SN_MIN_RTO 20
+#endif
+
+// Upper bound for the ack timeout, including backoff
+#ifndef RF24SN_MAX_RTO
+#define RF24SN_MAX_RTO 8000
+#endif
+
+// Number of nodes to keep round trip time estimates for
+#ifndef RF24SN_MAX_RTT_PEERS
+#define RF24SN_MAX_RTT_PEERS 4
+#endif
+
+// Number of buckets in the ack round trip time histogram
+#ifndef RF24SN_RTT_BUCKETS
+#define RF24SN_RTT_BUCKETS 8
+#endif
+
+// Number of nodes to keep a window of received sequence numbers for
+// A node only hears the gateway, a gateway on AVR should raise it to its number of clients
+#ifndef RF24SN_MAX_DEDUP_PEERS
+#if defined(__AVR__)
+#define RF24SN_MAX_DEDUP_PEERS 1
+#else
+#define RF24SN_MAX_DEDUP_PEERS 4
+#endif
+#endif
+
 #define RF24SN_RSP_FAILED -127
 
+// Handle that is never assigned to a request
+#define RF24SN_INVALID_HANDLE 0
+
+// Returned by getUpdateTimeout() when update() has no timed work
+#define RF24SN_NO_TIMEOUT 0xFFFFFFFF
+
+// Marks storage that holds a topic cache
+#define RF24SN_TOPIC_CACHE_MAGIC 0x5443
+
+// Payload that fits in a single RF24Network frame
+#define RF24SN_FRAME_PAYLOAD_SIZE (MAX_FRAME_SIZE - sizeof(RF24NetworkHeader))
+
+// Maximum number of values in a single batch publish
+#define RF24SN_MAX_BATCH_SIZE (RF24SN_FRAME_PAYLOAD_SIZE / sizeof(RF24SNPacket))
+
+// Largest request payload that can be sent asynchronously
+#define RF24SN_MAX_REQUEST_SIZE RF24SN_FRAME_PAYLOAD_SIZE
+
+// Largest response payload that can be received for an asynchronous request
+#define RF24SN_MAX_RESPONSE_SIZE sizeof(RF24SNStats)
+
+// Largest bulk subscribe request, sent fragmented if it does not fit in a frame
+#define RF24SN_SUBSCRIBE_MANY_SIZE (RF24SN_MAX_SUBSCRIBE_MANY * RF24SN_TOPIC_LENGTH)
+
+// Size of the receive buffer of a node, must hold a frame and the largest response
+// The gateway reads into its own buffer, see RF24SN_GATEWAY_RX_BUFFER_SIZE
+#ifndef RF24SN_RX_BUFFER_SIZE
+#define RF24SN_RX_BUFFER_SIZE (RF24SN_MAX_RESPONSE_SIZE > RF24SN_FRAME_PAYLOAD_SIZE ? RF24SN_MAX_RESPONSE_SIZE : RF24SN_FRAME_PAYLOAD_SIZE)
+#endif
+
+// Range of message types covered by the frame dispatch tables
+#define RF24SN_FIRST_MSG_TYPE RF24SN_PUBLISH
+#define RF24SN_MSG_TYPES (RF24SN_PUBLISH_TOPIC - RF24SN_PUBLISH + 1)
+
+// The frame dispatch tables are kept in flash on AVR, where RAM is scarce
+#if defined(__AVR__)
+#define RF24SN_TABLE_ATTR PROGMEM
+#define RF24SN_READ_TABLE(dst, src) memcpy_P(&(dst), &(src), sizeof(dst))
+#else
+#define RF24SN_TABLE_ATTR
+#define RF24SN_READ_TABLE(dst, src) ((dst) = (src))
+#endif
+
+// Largest ack payload that can be deferred, larger acks are sent right away
+#define RF24SN_MAX_ACK_SIZE sizeof(RF24SNSubscribeResponse)
+
 /**
  * Define the types of messages that can be sent over the RF24SN Network
  */
@@ -36,9 +192,33 @@ typedef enum {
 	RF24SN_SUBACK = 0x13,
 	RF24SN_SUBNACK = 0x14, // Subscribe failed
 	RF24SN_PINGREQ = 0x16,
-	RF24SN_PINGRES = 0x17
+	RF24SN_PINGRES = 0x17,
+	RF24SN_PUBLISH_BATCH = 0x20, // Publish several values, acked with a single PUBACK
+	RF24SN_PUBLISH_TYPED = 0x21, // Publish a value with a compact encoding
+	RF24SN_STATSREQ = 0x22, // Request the statistics of a node
+	RF24SN_STATSRES = 0x23,
+	RF24SN_SUBSCRIBE_MANY = 0x24, // Subscribe for several topics, acked with a single SUBACK
+	RF24SN_PUBLISH_TOPIC = 0x25 // Publish a value with the topic name, for topics matched by a wildcard
 } MsgTypes;
 
+/**
+ * Define the encodings a published value can be sent with
+ * The low nibble holds the encoding, the high nibble the number of decimals
+ * for the fixed point encodings, see RF24SN_VALUE_DECIMALS()
+ */
+typedef enum {
+	RF24SN_VALUE_FLOAT = 0x00, // 4 byte float, sent as a normal publish
+	RF24SN_VALUE_INT8 = 0x01,
+	RF24SN_VALUE_UINT8 = 0x02,
+	RF24SN_VALUE_INT16 = 0x03,
+	RF24SN_VALUE_FIXED16 = 0x04, // int16 divided by 10^decimals
+	RF24SN_VALUE_DELTA8 = 0x05, // int8 divided by 10^decimals, added to the last value
+	RF24SN_VALUE_DELTA16 = 0x06 // int16 divided by 10^decimals, added to the last value
+} ValueEncodings;
+
+// Combines a fixed point encoding with the number of decimals (0-7)
+#define RF24SN_VALUE_DECIMALS(encoding, decimals) ((encoding) | ((decimals) << 4))
+
 /**
  * A struct representing a request to subscribe for a topic
  */
@@ -58,6 +238,92 @@ struct __attribute__((__packed__))  RF24SNSubscribeResponse{
 	 * subscribed topic name
 	 */
 	byte topicId;
+
+	/**
+	 * Session of the client on the gateway, 0 if the gateway has none
+	 * Topic ids stay valid as long as the session does not change
+	 */
+	uint32_t session;
+};
+
+/**
+ * A struct representing a response to a bulk subscribe
+ * The request holds the topic names one after the other, each terminated by a '\0'
+ */
+struct __attribute__((__packed__))  RF24SNSubscribeManyResponse{
+	/**
+	 * Session of the client on the gateway, see RF24SNSubscribeResponse
+	 */
+	uint32_t session;
+
+	/**
+	 * Topic id for each topic in the order of the request, RF24SN_RSP_FAILED if
+	 * the topic could not be subscribed, only the requested topics are sent
+	 */
+	byte topicIds[RF24SN_MAX_SUBSCRIBE_MANY];
+};
+
+/**
+ * A struct sent with a ping by a node that powers its radio down between wake windows
+ * A ping without it leaves the duty cycle known to the gateway as it is
+ */
+struct __attribute__((__packed__))  RF24SNPingRequest{
+	/**
+	 * Time in ms the radio is powered down between two windows, 0 if it is always listening
+	 */
+	uint32_t sleepInterval;
+
+	/**
+	 * Time in ms the node listens after it woke up or last sent a frame
+	 */
+	uint16_t wakeWindow;
+};
+
+/**
+ * A struct representing a response to a ping
+ */
+struct __attribute__((__packed__))  RF24SNPingResponse{
+	/**
+	 * Session of the client on the gateway, 0 if the client is not registered
+	 * or the node is not a gateway
+	 */
+	uint32_t session;
+};
+
+/**
+ * A struct stored in front of the topic cache entries
+ */
+struct __attribute__((__packed__))  RF24SNTopicCacheHeader{
+	/**
+	 * RF24SN_TOPIC_CACHE_MAGIC if the storage holds a topic cache
+	 */
+	uint16_t magic;
+
+	/**
+	 * Layout of the entries, a cache written with other settings is discarded
+	 */
+	uint8_t topicLength;
+	uint8_t entryCount;
+
+	/**
+	 * Session the topic ids were given out in
+	 */
+	uint32_t session;
+};
+
+/**
+ * A struct representing a cached topic id
+ */
+struct __attribute__((__packed__))  RF24SNTopicCacheEntry{
+	/**
+	 * Name of the topic, empty if the entry is free
+	 */
+	char topicName[RF24SN_TOPIC_LENGTH];
+
+	/**
+	 * Topic id returned by the gateway
+	 */
+	byte topicId;
 };
 
 
@@ -66,10 +332,196 @@ struct __attribute__((__packed__))  RF24SNPacket{
 	float value;         //sensor reading
 };
 
+/**
+ * A struct representing a value sent with a compact encoding
+ */
+struct __attribute__((__packed__))  RF24SNTypedPacket{
+	/**
+	 * Sensor id
+	 */
+	uint8_t topicId;
+
+	/**
+	 * One of RF24SN_VALUE_*, with the decimals in the high nibble
+	 */
+	uint8_t encoding;
+
+	/**
+	 * Encoded value, delta encodings start with a tag of the value they are based on
+	 */
+	uint8_t value[sizeof(float)];
+};
+
+/**
+ * A struct representing a value for a topic matched by a wildcard subscription
+ */
+struct __attribute__((__packed__))  RF24SNTopicPacket{
+	/**
+	 * Topic id of the wildcard subscription
+	 */
+	uint8_t topicId;
+
+	/**
+	 * Sensor reading
+	 */
+	float value;
+
+	/**
+	 * Name of the topic that matched, only the characters are sent, not the terminator
+	 */
+	char topicName[RF24SN_TOPIC_LENGTH - 1];
+};
+
+/**
+ * A struct remembering the last value of a topic for delta encoding
+ */
+struct RF24SNValueHistory{
+	/**
+	 * Node the value was sent to or received from
+	 */
+	uint16_t nodeId = 0;
+
+	/**
+	 * Sensor id
+	 */
+	uint8_t topicId = 0;
+
+	/**
+	 * True if the value is valid
+	 */
+	bool hasValue = false;
+
+	/**
+	 * Last value
+	 */
+	float value = 0;
+};
+
+/**
+ * A struct holding counters of the network activity of a node
+ * The counters wrap around, the struct is sent as is in a RF24SN_STATSRES
+ */
+struct __attribute__((__packed__))  RF24SNStats{
+	/**
+	 * Frames written to the network
+	 */
+	uint32_t framesTx = 0;
+
+	/**
+	 * Frames read from the network
+	 */
+	uint32_t framesRx = 0;
+
+	/**
+	 * Requests that were sent again because no ack was received
+	 */
+	uint16_t retries = 0;
+
+	/**
+	 * Requests that failed because no ack was received after all retries
+	 */
+	uint16_t timeouts = 0;
+
+	/**
+	 * Received frames that were not expected and discarded
+	 */
+	uint16_t swallowed = 0;
+
+	/**
+	 * Publishes received again because the ack was lost, acked but not handled
+	 */
+	uint16_t duplicates = 0;
+
+	/**
+	 * Clients registered on the gateway
+	 */
+	uint16_t clientRegistrations = 0;
+
+	/**
+	 * Clients removed from the gateway because they were inactive
+	 */
+	uint16_t clientEvictions = 0;
+
+	/**
+	 * Time in ms the radio was powered up, see RF24SN::setDutyCycle()
+	 */
+	uint32_t radioOnTime = 0;
+
+	/**
+	 * Ack round trip times, bucket n counts the round trips below 8 << n ms,
+	 * the last bucket counts all longer round trips
+	 */
+	uint16_t ackRtt[RF24SN_RTT_BUCKETS] = {};
+};
+
+/**
+ * A struct holding the sequence numbers recently received from a node
+ */
+struct RF24SNSequenceWindow{
+	/**
+	 * Node the window is for
+	 */
+	uint16_t nodeId = 0;
+
+	/**
+	 * True if the window is in use
+	 */
+	bool valid = false;
+
+	/**
+	 * Highest sequence number received
+	 */
+	uint16_t highest = 0;
+
+	/**
+	 * Bit n is set if sequence number highest - n was received
+	 */
+	uint32_t received = 0;
+};
+
+/**
+ * A struct holding the round trip time estimate for a node
+ */
+struct RF24SNRttEstimate{
+	/**
+	 * Node the estimate is for
+	 */
+	uint16_t nodeId = 0;
+
+	/**
+	 * True if at least one round trip was measured
+	 */
+	bool valid = false;
+
+	/**
+	 * Smoothed round trip time in ms, multiplied by 8
+	 */
+	uint16_t srtt = 0;
+
+	/**
+	 * Round trip time variation in ms, multiplied by 4
+	 */
+	uint16_t rttvar = 0;
+};
+
+// The wire format, these structs are sent as is and must not be padded
+static_assert(sizeof(RF24SNPacket) == 5, "RF24SNPacket must be packed");
+static_assert(sizeof(RF24SNTypedPacket) == 6, "RF24SNTypedPacket must be packed");
+static_assert(sizeof(RF24SNSubscribeRequest) == RF24SN_TOPIC_LENGTH, "RF24SNSubscribeRequest must be packed");
+static_assert(sizeof(RF24SNSubscribeResponse) == 5, "RF24SNSubscribeResponse must be packed");
+static_assert(sizeof(RF24SNPingRequest) == 6, "RF24SNPingRequest must be packed");
+static_assert(sizeof(RF24SNPingResponse) == 4, "RF24SNPingResponse must be packed");
+static_assert(sizeof(RF24SNStats) == 24 + 2 * RF24SN_RTT_BUCKETS, "RF24SNStats must be packed");
+static_assert(sizeof(RF24SNTopicPacket) <= RF24SN_FRAME_PAYLOAD_SIZE, "RF24SN_TOPIC_LENGTH is too long for a topic packet");
+static_assert(sizeof(RF24SNTypedPacket) + sizeof(float) <= RF24SN_MAX_REQUEST_SIZE, "A typed publish request keeps the full value for its retries");
+static_assert(RF24SN_RX_BUFFER_SIZE >= RF24SN_MAX_RESPONSE_SIZE && RF24SN_RX_BUFFER_SIZE >= RF24SN_FRAME_PAYLOAD_SIZE,
+	"RF24SN_RX_BUFFER_SIZE must hold a full frame and the largest response");
+
 struct __attribute__((__packed__)) RF24SNMessage{
 	uint8_t messageType;		// Message Type
 	uint8_t fromNode;			// Node that sent the message
 	RF24SNPacket packet;		//sensor reading
+	const char* topicName;		// Topic that matched a wildcard subscription, NULL otherwise
 };
 
 
@@ -83,87 +535,766 @@ typedef struct {
 
 typedef void (*messageHandler)(RF24SNMessage&);
 
-class RF24SN{
+/**
+ * Lets a node sleep instead of polling the radio while it waits for a frame
+ */
+class RF24SNIdle{
 public:
+	virtual ~RF24SNIdle(){}
 
 	/**
-	 * Create a new instance of the RF24SN
+	 * Returns when a frame may have arrived, or at the latest after timeout ms
 	 */
-	RF24SN(RF24* radio, RF24Network* network, RF24SNConfig* config, messageHandler onMessageHandler);
+	virtual void wait(uint32_t timeout) = 0;
 
 	/**
-	 * Should be called during setup() to configure the network
+	 * Ends the current or next wait(), may be called from any thread
 	 */
-	virtual void begin(void);
+	virtual void wake(void){}
+};
 
+/**
+ * A struct representing an ack that is scheduled to be sent from update()
+ */
+struct RF24SNDeferredAck{
 	/**
-	 * Publish a value
-	 * @param nodeId ID of the node to send the message to
-	 * @param sensorId ID of the sensor this reading is for
-	 * @param value The value to send
+	 * Node to send the ack to
 	 */
-	bool publish(uint16_t nodeId, uint8_t sensorId, float value);
+	uint16_t nodeId = 0;
 
 	/**
-	 * Publish a value
-	 * @param nodeId ID of the node to send the message to
-	 * @param sensorId ID of the sensor this reading is for
-	 * @param value The value to send
-	 * @param retries Number of times to retry sending the value
+	 * Type of the ack message, 0 if the slot is free
 	 */
-	bool publish(uint16_t nodeId, uint8_t sensorId, float value, int retries);
+	uint8_t messageType = 0;
 
 	/**
-	 * Subscribes for a topic
-	 * Returns the id of the topic which will be used for published messages
-	 *
-	 * returns RF24SN_RSP_FAILED (-127) if failed
+	 * Sequence number of the request that is acked
 	 */
-	byte subscribe(const char* topic);
+	uint16_t sequence = 0;
 
 	/**
-	 * This function should be called regularly to keep the network active
+	 * Ack data
 	 */
-	void update(void);
+	uint8_t payload[RF24SN_MAX_ACK_SIZE];
 
-protected:
-	RF24* _radio;
-	RF24Network* _network;
-	RF24SNConfig* _config;
-	messageHandler _onMessageHandler;
-	uint8_t getAckType(uint8_t request);
+	/**
+	 * Length of the ack data
+	 */
+	uint8_t payloadLength = 0;
 
 	/**
-	 * Sends a request to the broker
-	 * @param messageType The message type to send in the header
-	 * @param requestPacket Optional request data to send with
-	 * @param responsePacket Optional pointer to where response data must be saved
-	 *
-	 * @return True if the expected response is received in time
+	 * Time the ack was queued
+	 */
+	uint32_t queuedAt = 0;
+};
+
+struct RF24SNRequest;
+
+/**
+ * Called from update() when an asynchronous request completes or times out
+ * @param request The request that completed
+ * @param success True if the expected ack was received
+ * @param response Payload of the ack, NULL if it failed
+ * @param responseLength Length of the ack payload
+ */
+typedef void (*requestHandler)(const RF24SNRequest& request, bool success, const void* response, uint16_t responseLength);
+
+/**
+ * A struct representing an asynchronous request that is waiting for an ack
+ */
+struct RF24SNRequest{
+	/**
+	 * Handle returned to the caller, RF24SN_INVALID_HANDLE if the slot is free
+	 */
+	uint8_t handle = RF24SN_INVALID_HANDLE;
+
+	/**
+	 * Node the request was sent to
+	 */
+	uint16_t nodeId = 0;
+
+	/**
+	 * Type of the request message
+	 */
+	uint8_t messageType = 0;
+
+	/**
+	 * Sequence number sent in the header id of every transmission, echoed by the ack
+	 */
+	uint16_t sequence = 0;
+
+	/**
+	 * Request data, kept to be able to resend it
+	 */
+	uint8_t payload[RF24SN_MAX_REQUEST_SIZE];
+
+	/**
+	 * Length of the request data
+	 */
+	uint8_t payloadLength = 0;
+
+	/**
+	 * Number of transmissions left before the request fails
+	 */
+	uint8_t transmissionsLeft = 0;
+
+	/**
+	 * Number of times the request was sent
+	 */
+	uint8_t transmissions = 0;
+
+	/**
+	 * Time of the last transmission
+	 */
+	uint32_t sentAt = 0;
+
+	/**
+	 * Time to wait for the ack after the last transmission
+	 */
+	uint16_t timeout = 0;
+
+	/**
+	 * Handler to call when the request completes
+	 */
+	requestHandler onComplete = NULL;
+};
+
+class RF24SN{
+public:
+
+	/**
+	 * Create a new instance of the RF24SN
+	 */
+	RF24SN(RF24* radio, RF24Network* network, RF24SNConfig* config, messageHandler onMessageHandler);
+
+	virtual ~RF24SN(){}
+
+	/**
+	 * Should be called during setup() to configure the network
+	 */
+	virtual void begin(void);
+
+	/**
+	 * Publish a value
+	 * @param nodeId ID of the node to send the message to
+	 * @param sensorId ID of the sensor this reading is for
+	 * @param value The value to send
+	 */
+	bool publish(uint16_t nodeId, uint8_t sensorId, float value);
+
+	/**
+	 * Publish a value
+	 * @param nodeId ID of the node to send the message to
+	 * @param sensorId ID of the sensor this reading is for
+	 * @param value The value to send
+	 * @param retries Number of times to retry sending the value
+	 */
+	bool publish(uint16_t nodeId, uint8_t sensorId, float value, int retries);
+
+	/**
+	 * Subscribes for a topic
+	 * Returns the id of the topic which will be used for published messages
+	 *
+	 * returns RF24SN_RSP_FAILED (-127) if failed, right away if the gateway refused the topic with a SUBNACK
+	 */
+	byte subscribe(const char* topic);
+
+	/**
+	 * Subscribes for several topics with a single request
+	 * Topics found in the topic cache are not sent, see setTopicCache()
+	 * @param topics Names of the topics
+	 * @param count Number of topics, at most RF24SN_MAX_SUBSCRIBE_MANY
+	 * @param topicIds Receives the id of each topic, RF24SN_RSP_FAILED (-127) if
+	 * the topic could not be subscribed
+	 *
+	 * @return False if no SUBACK was received, gateways without bulk subscribe never answer
+	 * and a gateway without room for another client answers with a SUBNACK
+	 */
+	bool subscribeMany(const char* const* topics, uint8_t count, byte* topicIds);
+
+	/**
+	 * Publish a value with a compact encoding
+	 * Values that do not fit the encoding are sent as a float, delta encoded values
+	 * are sent in full if the last value for the topic is not known
+	 * A receiver that lost the base of a delta does not ack it, the retries send the value as a float
+	 * @param nodeId ID of the node to send the message to
+	 * @param sensorId ID of the sensor this reading is for
+	 * @param value The value to send
+	 * @param retries Number of times to retry sending the value
+	 * @param encoding One of RF24SN_VALUE_*, see RF24SN_VALUE_DECIMALS()
+	 */
+	bool publish(uint16_t nodeId, uint8_t sensorId, float value, int retries, uint8_t encoding);
+
+	/**
+	 * Publish several values in a single frame, acked with a single PUBACK
+	 * @param nodeId ID of the node to send the message to
+	 * @param packets The sensor readings to send
+	 * @param count Number of readings, at most RF24SN_MAX_BATCH_SIZE
+	 */
+	bool publishBatch(uint16_t nodeId, const RF24SNPacket* packets, uint8_t count);
+
+	/**
+	 * Publish several values in a single frame, acked with a single PUBACK
+	 * @param nodeId ID of the node to send the message to
+	 * @param packets The sensor readings to send
+	 * @param count Number of readings, at most RF24SN_MAX_BATCH_SIZE
+	 * @param retries Number of times to retry sending the values
+	 */
+	bool publishBatch(uint16_t nodeId, const RF24SNPacket* packets, uint8_t count, int retries);
+
+	/**
+	 * Publish several values in a single frame without waiting for the ack
+	 * @param nodeId ID of the node to send the message to
+	 * @param packets The sensor readings to send
+	 * @param count Number of readings, at most RF24SN_MAX_BATCH_SIZE
+	 * @param retries Number of times to retry sending the values
+	 * @param onComplete Called from update() when the values are acked or timed out
+	 *
+	 * @return Handle of the request, RF24SN_INVALID_HANDLE if it could not be queued
+	 */
+	uint8_t publishBatchAsync(uint16_t nodeId, const RF24SNPacket* packets, uint8_t count, int retries, requestHandler onComplete);
+
+	/**
+	 * Publish a value without waiting for the ack
+	 * @param nodeId ID of the node to send the message to
+	 * @param sensorId ID of the sensor this reading is for
+	 * @param value The value to send
+	 * @param onComplete Called from update() when the value is acked or timed out
+	 *
+	 * @return Handle of the request, RF24SN_INVALID_HANDLE if it could not be queued
+	 */
+	uint8_t publishAsync(uint16_t nodeId, uint8_t sensorId, float value, requestHandler onComplete);
+
+	/**
+	 * Publish a value without waiting for the ack
+	 * @param nodeId ID of the node to send the message to
+	 * @param sensorId ID of the sensor this reading is for
+	 * @param value The value to send
+	 * @param retries Number of times to retry sending the value
+	 * @param onComplete Called from update() when the value is acked or timed out
+	 *
+	 * @return Handle of the request, RF24SN_INVALID_HANDLE if it could not be queued
+	 */
+	uint8_t publishAsync(uint16_t nodeId, uint8_t sensorId, float value, int retries, requestHandler onComplete);
+
+	/**
+	 * Publish a value with a compact encoding without waiting for the ack
+	 * @param nodeId ID of the node to send the message to
+	 * @param sensorId ID of the sensor this reading is for
+	 * @param value The value to send
+	 * @param retries Number of times to retry sending the value
+	 * @param encoding One of RF24SN_VALUE_*, see RF24SN_VALUE_DECIMALS()
+	 * @param onComplete Called from update() when the value is acked or timed out
+	 *
+	 * @return Handle of the request, RF24SN_INVALID_HANDLE if it could not be queued
+	 */
+	uint8_t publishAsync(uint16_t nodeId, uint8_t sensorId, float value, int retries, uint8_t encoding, requestHandler onComplete);
+
+	/**
+	 * Subscribes for a topic without waiting for the ack
+	 * The topic id is passed to onComplete as a RF24SNSubscribeResponse
+	 * A topic refused by the gateway completes as failed without a response
+	 *
+	 * @return Handle of the request, RF24SN_INVALID_HANDLE if it could not be queued
+	 */
+	uint8_t subscribeAsync(const char* topic, requestHandler onComplete);
+
+	/**
+	 * Checks if a node is reachable
+	 * @return True if the node answered with a PINGRES
+	 */
+	bool ping(uint16_t nodeId);
+
+	/**
+	 * Checks if a node is reachable without waiting for the response
+	 *
+	 * @return Handle of the request, RF24SN_INVALID_HANDLE if it could not be queued
+	 */
+	uint8_t pingAsync(uint16_t nodeId, requestHandler onComplete);
+
+	/**
+	 * Keeps the topic ids returned by the gateway in storage, so subscribe()
+	 * can answer from the cache after a reboot
+	 * The cache is checked with a single PINGREQ on the first subscribe(), it is
+	 * only used while the gateway still has the session the ids were given out in
+	 * @param storage Storage for the cache, NULL to disable
+	 */
+	void setTopicCache(RF24SNStorage* storage);
+
+	/**
+	 * Sends a PINGREQ to the base node whenever nothing was sent to it for the
+	 * given time, so a node that only receives stays registered on the gateway
+	 * @param interval Time in ms, 0 to disable
+	 */
+	void setKeepAliveInterval(uint32_t interval);
+
+	/**
+	 * Powers the radio down between wake windows, update() wakes it every sleepInterval
+	 * and tells the base node with a PINGREQ, which holds the values for this node
+	 * until then. The radio stays on while requests or acks are pending, and
+	 * sending a frame wakes it up and extends the window
+	 * The sleep interval must be shorter than the inactive timeout of the gateway
+	 * @param sleepInterval Time in ms, 0 to keep the radio on
+	 * @param wakeWindow Time in ms to listen after waking up or sending a frame
+	 */
+	void setDutyCycle(uint32_t sleepInterval, uint16_t wakeWindow);
+
+	/**
+	 * Requests the statistics of another node without waiting for the response
+	 * The statistics are passed to onComplete as a RF24SNStats
+	 *
+	 * @return Handle of the request, RF24SN_INVALID_HANDLE if it could not be queued
+	 */
+	uint8_t requestStats(uint16_t nodeId, requestHandler onComplete);
+
+	/**
+	 * Statistics of this node
+	 */
+	const RF24SNStats& getStats(void);
+
+	/**
+	 * Sets all statistics of this node back to 0
+	 */
+	void resetStats(void);
+
+	/**
+	 * Check if an asynchronous request is still waiting for its ack
+	 */
+	bool isPending(uint8_t handle);
+
+	/**
+	 * Drops an asynchronous request without calling its handler
+	 */
+	void cancelRequest(uint8_t handle);
+
+	/**
+	 * Sets what blocking calls do while no frame is available, see RF24SNEventLoop
+	 * @param idle NULL to keep polling the radio
+	 */
+	void setIdle(RF24SNIdle* idle);
+
+	/**
+	 * Time in ms until update() has to resend a request, send an ack or a keep
+	 * alive, frames that arrive in the meantime are not taken into account
+	 * @return RF24SN_NO_TIMEOUT if nothing is scheduled
+	 */
+	virtual uint32_t getUpdateTimeout(void);
+
+	/**
+	 * This function should be called regularly to keep the network active
+	 */
+	void update(void);
+
+protected:
+	/**
+	 * Handler for the frame in the receive buffer
+	 */
+	typedef void (RF24SN::*frameHandler)(void);
+
+	RF24* _radio;
+	RF24Network* _network;
+	RF24SNConfig* _config;
+	messageHandler _onMessageHandler;
+
+	/**
+	 * Wait of blocking calls, NULL to poll
+	 */
+	RF24SNIdle* _idle;
+	RF24SNStats _stats;
+	uint8_t getAckType(uint8_t request);
+
+	/**
+	 * True if a frame answers a request that expects ackType, a SUBNACK answers a subscribe
+	 */
+	static bool isAnswer(uint8_t ackType, uint8_t frameType);
+
+	/**
+	 * Sends a request to the broker
+	 * @param messageType The message type to send in the header
+	 * @param requestPacket Optional request data to send with
+	 * @param responsePacket Optional pointer to where response data must be saved
+	 *
+	 * @return True if the expected response is received in time
 	 */
 	bool sendRequest(uint16_t nodeId, uint8_t messageType, const void* requestPacket, uint16_t reqLen, void* responsePacket, uint16_t resLen);
 	bool sendRequest(uint16_t nodeId, uint8_t messageType, const void* requestPacket, uint16_t reqLen, void* responsePacket, uint16_t resLen, int retries);
-	bool waitForPacket(uint8_t type, void* responsePacket, uint16_t resLen);
+	bool waitForPacket(uint16_t nodeId, uint16_t sequence, uint8_t type, void* responsePacket, uint16_t resLen, uint16_t timeout);
+
+	/**
+	 * Next sequence number for a request
+	 * Numbering starts at 0 after a restart, which tells receivers to reset their window
+	 */
+	uint16_t nextSequence(void);
+
+	/**
+	 * Check if a publish with this sequence number was already handled
+	 */
+	bool isDuplicate(uint16_t nodeId, uint16_t sequence);
+
+	/**
+	 * Forgets the sequence numbers handled for a node that restarted
+	 */
+	void restartSequence(uint16_t nodeId);
+
+	/**
+	 * Marks a sequence number as handled
+	 */
+	void acceptSequence(uint16_t nodeId, uint16_t sequence);
+
+	/**
+	 * Queues a request to the broker, the ack is handled from update()
+	 * @return Handle of the request, RF24SN_INVALID_HANDLE if no slot is free
+	 */
+	uint8_t sendRequestAsync(uint16_t nodeId, uint8_t messageType, const void* requestPacket, uint16_t reqLen, int retries, requestHandler onComplete);
+
+	/**
+	 * Time to wait for an ack before resending a request
+	 * Based on the round trip time to the node, doubled for every retry and with a random jitter
+	 * @param nodeId Node the request is sent to
+	 * @param attempt Number of times the request was sent before
+	 */
+	uint16_t getAckTimeout(uint16_t nodeId, uint8_t attempt);
+
+	/**
+	 * Adds a round trip time measurement to the estimate for the node
+	 */
+	void updateRtt(uint16_t nodeId, uint32_t rtt);
+
+	/**
+	 * Called when an asynchronous request completes or fails
+	 */
+	virtual void onRequestComplete(const RF24SNRequest& request, bool success, const void* response, uint16_t responseLength);
+
+	/**
+	 * Header of the frame in the receive buffer
+	 */
+	RF24NetworkHeader _rxHeader;
+
+	/**
+	 * Payload of the frame in the receive buffer, always followed by a '\0'
+	 * Points to _nodeRxBuffer unless a subclass needs a larger buffer
+	 */
+	uint8_t* _rxBuffer;
+
+	/**
+	 * Size of the receive buffer, without the room for the '\0'
+	 */
+	uint16_t _rxBufferSize;
+
+	/**
+	 * Receive buffer of a node
+	 */
+	uint8_t _nodeRxBuffer[RF24SN_RX_BUFFER_SIZE + 1];
+
+	/**
+	 * Length of the payload in the receive buffer
+	 */
+	uint16_t _rxLength;
 
 	/**
-	 * Handles any incoming message.
+	 * Reads the next frame into the receive buffer, frames are only read from the network here
+	 * Handlers that might block must copy what they need first, a blocking request reuses the buffer
+	 */
+	void receiveFrame(void);
+
+	/**
+	 * Handles the frame in the receive buffer
 	 */
 	virtual bool handleMessage(bool swallowInvalid = true);
 
+	/**
+	 * Looks up the handler for a message type
+	 * Derived classes handle more message types by checking their own table first
+	 * @return NULL if the message type is not handled
+	 */
+	virtual frameHandler getFrameHandler(uint8_t messageType);
+
 	/**
 	 * Handle a published message
 	 */
 	void handlePublishMessage(void);
 
+	/**
+	 * Handle a batch of published values, each value is passed to the message handler
+	 */
+	void handlePublishBatchMessage(void);
+
+	/**
+	 * Handle a value with a compact encoding, it is passed to the message handler as a float
+	 */
+	void handlePublishTypedMessage(void);
+
+	/**
+	 * Handle a value for a topic matched by a wildcard, the topic name is passed to the message handler
+	 */
+	void handlePublishTopicMessage(void);
+
+	/**
+	 * Encodes a value for a typed publish
+	 * @return Length of the packet, 0 if the value should be sent as a float
+	 */
+	uint8_t encodeValue(uint16_t nodeId, uint8_t sensorId, float value, uint8_t encoding, RF24SNTypedPacket& packet);
+
+	/**
+	 * Decodes a value of a typed publish
+	 * @return False if the value could not be decoded
+	 */
+	bool decodeValue(uint16_t nodeId, const RF24SNTypedPacket& packet, uint16_t len, float& value);
+
+	/**
+	 * Writes a frame to the network and counts it
+	 */
+	bool writeFrame(RF24NetworkHeader& header, const void* payload, uint16_t len);
+
+	/**
+	 * Discards the frame in the receive buffer
+	 */
+	void swallowFrame(void);
+
+	/**
+	 * Answer a statistics request
+	 */
+	void handleStatsRequest(void);
+
+	/**
+	 * Answer a ping request
+	 */
+	virtual void handlePingRequest(void);
+
+	/**
+	 * Schedules an ack to be sent after RF24SN_ACK_DELAY
+	 * The ack is sent right away if it is too large or no slot is free
+	 * @param sequence Sequence number of the request, echoed in the header id
+	 */
+	void queueAck(uint16_t nodeId, uint8_t messageType, uint16_t sequence, const void* payload, uint16_t len);
+
+	/**
+	 * Sends all queued acks that are due
+	 */
+	void sendDeferredAcks(void);
+
+	/**
+	 * Time in ms until the first deferred ack is due, RF24SN_NO_TIMEOUT if none is queued
+	 */
+	uint32_t getDeferredAckTimeout(void);
+
+	/**
+	 * Number of free slots in the request table, sendRequestAsync() needs one
+	 */
+	uint8_t freeRequests(void);
+
+	/**
+	 * Handle an ack for an asynchronous request, acks no request is waiting for are swallowed
+	 */
+	void handleAck(void);
+
 	/**
 	 * Check if a timeout has passed
 	 */
 	bool hasTimedout(uint32_t from, uint32_t period);
 
+	/**
+	 * Time left until a timeout has passed, 0 if it has
+	 */
+	uint32_t timeLeft(uint32_t from, uint32_t period);
+
 private:
+	/**
+	 * Handlers indexed by message type - RF24SN_FIRST_MSG_TYPE
+	 */
+	static const frameHandler frameHandlers[RF24SN_MSG_TYPES];
+
+	/**
+	 * Requests that are waiting for an ack
+	 */
+	RF24SNRequest _requests[RF24SN_MAX_PENDING_REQUESTS];
+
+	/**
+	 * Last handle that was given out
+	 */
+	uint8_t _lastHandle;
+
+	/**
+	 * Acks waiting to be sent
+	 */
+	RF24SNDeferredAck _acks[RF24SN_MAX_DEFERRED_ACKS];
+
+	/**
+	 * Last values sent with a typed publish, base for delta encoding
+	 */
+	RF24SNValueHistory _sentValues[RF24SN_MAX_DELTA_TOPICS];
+
+	/**
+	 * Last values received with a typed publish, base for delta decoding
+	 */
+	RF24SNValueHistory _receivedValues[RF24SN_MAX_DELTA_TOPICS];
+
+	/**
+	 * Keep alive interval, 0 if disabled
+	 */
+	uint32_t _keepAliveInterval;
+
+	/**
+	 * Last time a frame was sent to the base node
+	 */
+	uint32_t _lastBaseTx;
+
+	/**
+	 * Send a PINGREQ to the base node if the keep alive interval passed
+	 */
+	void checkKeepAlive(void);
+
+	/**
+	 * Duty cycle, see setDutyCycle()
+	 */
+	uint32_t _sleepInterval;
+	uint16_t _wakeWindow;
+
+	/**
+	 * True while the radio is powered down
+	 */
+	bool _asleep;
+
+	/**
+	 * Last time the radio was powered down
+	 */
+	uint32_t _sleptAt;
+
+	/**
+	 * Last time the radio woke up or a frame was sent, the window starts there
+	 */
+	uint32_t _windowStart;
+
+	/**
+	 * Time up to which the radio on time is counted in the statistics
+	 */
+	uint32_t _radioOnSince;
+
+	/**
+	 * Counts the radio on time, powers the radio down after the wake window
+	 * and up again after the sleep interval
+	 */
+	void updateDutyCycle(void);
+
+	/**
+	 * Powers the radio up and starts a wake window
+	 */
+	void wakeRadio(void);
+
+	/**
+	 * Sends the duty cycle to the base node
+	 */
+	void announceDutyCycle(void);
+
+	/**
+	 * Sequence number of the next request
+	 */
+	uint16_t _nextSequence;
+
+	/**
+	 * Windows of received sequence numbers per node
+	 */
+	RF24SNSequenceWindow _sequenceWindows[RF24SN_MAX_DEDUP_PEERS];
+
+	/**
+	 * Next window to replace when the table is full
+	 */
+	uint8_t _nextSequenceWindow;
+
+	/**
+	 * Round trip time estimates per node
+	 */
+	RF24SNRttEstimate _rttEstimates[RF24SN_MAX_RTT_PEERS];
+
+	/**
+	 * Next round trip time estimate to replace when the table is full
+	 */
+	uint8_t _nextRttEstimate;
+
+	/**
+	 * Storage of the topic cache, NULL if disabled
+	 */
+	RF24SNStorage* _topicCache;
+
+	/**
+	 * Session of the topic ids in the cache
+	 */
+	uint32_t _topicCacheSession;
+
+	/**
+	 * True once the gateway confirmed the session of the cache
+	 */
+	bool _topicCacheValid;
+
+	/**
+	 * True once the cache was checked against the gateway
+	 */
+	bool _topicCacheChecked;
+
+	/**
+	 * Checks if the gateway still has the session of the cached topic ids
+	 */
+	void checkTopicCache(void);
+
+	/**
+	 * Looks up a topic in the cache
+	 * @return The topic id, RF24SN_RSP_FAILED if the topic is not cached
+	 */
+	byte findCachedTopic(const char* topic);
+
+	/**
+	 * Stores a topic id returned by the gateway, clearing the cache if the session changed
+	 */
+	void cacheTopic(const char* topic, const RF24SNSubscribeResponse& response);
+
+	/**
+	 * Next history entry to replace when a table is full
+	 */
+	uint8_t _nextSentValue;
+	uint8_t _nextReceivedValue;
+
+	/**
+	 * Finds the history entry for a topic, optionally claiming one if not found
+	 */
+	RF24SNValueHistory* findValueHistory(RF24SNValueHistory* history, uint8_t& next, uint16_t nodeId, uint8_t topicId, bool create);
+
+	/**
+	 * Short check value of a float, sent with delta encoded values
+	 */
+	static uint8_t valueTag(float value);
+
+	/**
+	 * (Re)sends a pending request
+	 */
+	void transmitRequest(RF24SNRequest& request);
+
+	/**
+	 * Pending request with a handle, NULL if it completed
+	 */
+	RF24SNRequest* findRequest(uint8_t handle);
+
+	/**
+	 * Turns the retry of a delta encoded value into a publish of the full value,
+	 * the receiver did not ack the delta if it lost the base, the same bytes would fail again
+	 * @param typedPacket Typed packet of len bytes, followed by the full value as a float
+	 * @param packet Receives the RF24SNPacket, may be typedPacket
+	 * @return Length of the packet, 0 if the value is not delta encoded
+	 */
+	uint8_t fullValueRetry(uint16_t nodeId, const uint8_t* typedPacket, uint8_t len, uint8_t* packet);
+
+	/**
+	 * Resend or fail requests for which no ack was received in time
+	 */
+	void checkPendingRequests(void);
+
+	/**
+	 * Frees the request slot and notifies the handler
+	 */
+	void completeRequest(RF24SNRequest& request, bool success, const void* response, uint16_t responseLength);
 
 #ifdef RF24SN_HAS_LEDS
 	byte _ledFlags;
+	uint32_t _ledsLitAt;
 	void updateLeds(void);
 #endif
 };
@@ -0,0 +1,149 @@
+#include "RF24SNEventLoop.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+RF24SNEventLoop::RF24SNEventLoop(){
+	_epollFd = -1;
+	_timerFd = -1;
+	_wakeFd = -1;
+	_radioFd = -1;
+	for(uint8_t idx = 0 ; idx < RF24SN_MAX_EVENT_FDS; idx++){
+		_fds[idx] = -1;
+		_handlers[idx] = NULL;
+	}
+}
+
+RF24SNEventLoop::~RF24SNEventLoop(){
+	RF24SNEventLoop::release();
+}
+
+bool RF24SNEventLoop::begin(int radioFd){
+	if(_epollFd >= 0){
+		return true;
+	}
+	_epollFd = epoll_create1(EPOLL_CLOEXEC);
+	_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(_epollFd < 0 || _timerFd < 0 || _wakeFd < 0 || !watch(_timerFd) || !watch(_wakeFd)){
+		release();
+		return false;
+	}
+	if(radioFd >= 0){
+		// Only read until it would block, the handlers of the radio do not block
+		fcntl(radioFd, F_SETFL, fcntl(radioFd, F_GETFL) | O_NONBLOCK);
+		if(!watch(radioFd)){
+			release();
+			return false;
+		}
+	}
+	_radioFd = radioFd;
+	return true;
+}
+
+bool RF24SNEventLoop::addFd(int fd, fdHandler onReadable){
+	for(uint8_t idx = 0 ; idx < RF24SN_MAX_EVENT_FDS; idx++){
+		if(_fds[idx] < 0){
+			if(!watch(fd)){
+				return false;
+			}
+			_fds[idx] = fd;
+			_handlers[idx] = onReadable;
+			return true;
+		}
+	}
+	return false;
+}
+
+void RF24SNEventLoop::removeFd(int fd){
+	for(uint8_t idx = 0 ; idx < RF24SN_MAX_EVENT_FDS; idx++){
+		if(_fds[idx] == fd){
+			epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, NULL);
+			_fds[idx] = -1;
+			_handlers[idx] = NULL;
+		}
+	}
+}
+
+void RF24SNEventLoop::wake(void){
+	uint64_t one = 1;
+	if(write(_wakeFd, &one, sizeof(one)) < 0){
+		// The counter is full, the loop is woken up already
+	}
+}
+
+void RF24SNEventLoop::wait(uint32_t timeout){
+	// Without an IRQ the radio has to be checked anyway
+	uint64_t timeoutUs = (uint64_t)timeout * 1000;
+	if(_radioFd < 0 && timeoutUs > RF24SN_RADIO_POLL_INTERVAL){
+		timeoutUs = RF24SN_RADIO_POLL_INTERVAL;
+	}
+
+	if(_epollFd < 0){
+		// Not begun or begin() failed, sleep like a polled radio instead of spinning
+		usleep(timeoutUs);
+		return;
+	}
+
+	int epollTimeout = 0;
+	if(timeoutUs > 0){
+		// Armed once for this wait, a new setting also clears expirations that were not read
+		struct itimerspec timer = {};
+		timer.it_value.tv_sec = timeoutUs / 1000000;
+		timer.it_value.tv_nsec = (timeoutUs % 1000000) * 1000;
+		timerfd_settime(_timerFd, 0, &timer, NULL);
+		epollTimeout = -1;
+	}
+
+	struct epoll_event events[RF24SN_MAX_EVENT_FDS + 3];
+	int count = epoll_wait(_epollFd, events, RF24SN_MAX_EVENT_FDS + 3, epollTimeout);
+	for(int event = 0 ; event < count; event++){
+		int fd = events[event].data.fd;
+		if(fd == _timerFd || fd == _wakeFd || fd == _radioFd){
+			RF24SNEventLoop::drain(fd);
+			continue;
+		}
+		for(uint8_t idx = 0 ; idx < RF24SN_MAX_EVENT_FDS; idx++){
+			if(_fds[idx] == fd && _handlers[idx] != NULL){
+				_handlers[idx](fd);
+			}
+		}
+	}
+}
+
+bool RF24SNEventLoop::watch(int fd){
+	struct epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	return epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+void RF24SNEventLoop::release(void){
+	if(_epollFd >= 0){
+		close(_epollFd);
+	}
+	if(_timerFd >= 0){
+		close(_timerFd);
+	}
+	if(_wakeFd >= 0){
+		close(_wakeFd);
+	}
+	_epollFd = -1;
+	_timerFd = -1;
+	_wakeFd = -1;
+	_radioFd = -1;
+}
+
+void RF24SNEventLoop::drain(int fd){
+	uint8_t buffer[64];
+	while(read(fd, buffer, sizeof(buffer)) > 0){
+	}
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef RF24SNEventLoop_h
+#define RF24SNEventLoop_h
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include "RF24SN.h"
+
+// Time between two polls of a radio without an IRQ file descriptor, in microseconds
+#ifndef RF24SN_RADIO_POLL_INTERVAL
+#define RF24SN_RADIO_POLL_INTERVAL 1000
+#endif
+
+// Number of file descriptors of the application an event loop can watch
+#ifndef RF24SN_MAX_EVENT_FDS
+#define RF24SN_MAX_EVENT_FDS 8
+#endif
+
+/**
+ * Called from wait() when a file descriptor added with addFd() is readable
+ */
+typedef void (*fdHandler)(int fd);
+
+/**
+ * Sleeps with epoll until the radio, a file descriptor of the application
+ * (like the broker socket) or a timer needs attention, instead of polling
+ *
+ * The radio is watched through a file descriptor that becomes readable when
+ * its IRQ line fires, like a GPIO line event. Without one the radio is still
+ * polled every RF24SN_RADIO_POLL_INTERVAL
+ *
+ *	gateway.setIdle(&loop);
+ *	while(true){
+ *		gateway.update();
+ *		loop.wait(gateway.getUpdateTimeout());
+ *	}
+ */
+class RF24SNEventLoop : public RF24SNIdle{
+public:
+	RF24SNEventLoop();
+
+	/**
+	 * Closes the file descriptors of the loop, those of the radio and the application stay open
+	 */
+	~RF24SNEventLoop();
+
+	/**
+	 * Creates the epoll, timer and wake up file descriptors
+	 * @param radioFd Readable when the radio has a frame, it is read and discarded, -1 to poll
+	 * @return False if a file descriptor could not be created, wait() then sleeps like with a polled radio
+	 */
+	bool begin(int radioFd = -1);
+
+	/**
+	 * Watches a file descriptor, onReadable is called from wait() as long as it is readable
+	 * @return False if RF24SN_MAX_EVENT_FDS are watched already
+	 */
+	bool addFd(int fd, fdHandler onReadable);
+
+	/**
+	 * Stops watching a file descriptor
+	 */
+	void removeFd(int fd);
+
+	/**
+	 * Ends the current or next wait(), may be called from any thread
+	 */
+	void wake(void);
+
+	/**
+	 * Sleeps until the radio fires, a file descriptor is readable, wake() is
+	 * called or timeout ms passed, calls the handlers of the readable file descriptors
+	 * Blocking calls of a node that uses the loop call this as well
+	 */
+	void wait(uint32_t timeout);
+
+private:
+	int _epollFd;
+	int _timerFd;
+	int _wakeFd;
+	int _radioFd;
+
+	/**
+	 * File descriptors of the application, -1 if free
+	 */
+	int _fds[RF24SN_MAX_EVENT_FDS];
+	fdHandler _handlers[RF24SN_MAX_EVENT_FDS];
+
+	/**
+	 * Adds a file descriptor to the epoll set
+	 */
+	bool watch(int fd);
+
+	/**
+	 * Closes the file descriptors of the loop, wait() sleeps until begin() succeeds
+	 */
+	void release(void);
+
+	/**
+	 * Reads a file descriptor until it would block
+	 */
+	static void drain(int fd);
+};
+
+#endif
+
+#endif
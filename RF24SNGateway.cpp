@@ -1,258 +1,119 @@
 #include "RF24SNGateway.h"
 #include "RF24SN.h"
 
-RF24SNGateway::RF24SNGateway(RF24* radio, RF24Network* network, RF24SNConfig* config, messageHandler onMessageHandler, subsribeHandler onSubsribeHandler):RF24SN(radio, network, config, onMessageHandler){
+RF24SNGatewayBase::RF24SNGatewayBase(RF24* radio, RF24Network* network, RF24SNConfig* config, messageHandler onMessageHandler, subsribeHandler onSubsribeHandler):RF24SN(radio, network, config, onMessageHandler){
 	_onSubsribeHandler = onSubsribeHandler;
+	_onUnsubscribeHandler = NULL;
+	_onDeliveryHandler = NULL;
+	_queuePolicy = RF24SN_QUEUE_DROP_OLDEST;
+	_epochStorage = NULL;
+	_epoch = 0;
+	_lastRegistration = 0;
+	_rxBuffer = _gatewayRxBuffer;
+	_rxBufferSize = RF24SN_GATEWAY_RX_BUFFER_SIZE;
 }
 
-void RF24SNGateway::begin(void){
-	RF24SN::begin();
+void RF24SNGatewayBase::setUnsubscribeHandler(unsubscribeHandler onUnsubscribeHandler){
+	_onUnsubscribeHandler = onUnsubscribeHandler;
 }
 
-void RF24SNGateway::update(void){
-	RF24SN::update();
-	RF24SNGateway::checkInactiveClients();
+void RF24SNGatewayBase::setQueuePolicy(uint8_t policy){
+	_queuePolicy = policy;
 }
 
-void RF24SNGateway::checkInactiveClients(void){
-	// Check clients
-	if(RF24SN::hasTimedout(lastInactiveCheck, RF24SN_CLIENT_INACTIVE_DELAY)){
-		IF_RF24SN_DEBUG(
-			Serial.print(F("Chk i/a "));
-			Serial.println(lastInactiveCheck);
-		);
-		lastInactiveCheck = millis();
-		for(byte clientIndex = 0 ; clientIndex < RF24SN_MAX_CLIENTS; clientIndex++){
-			if(clients[clientIndex].clientId != RF24SN_CLIENT_EMPTY_ID
-				&& RF24SN::hasTimedout(clients[clientIndex].lastActivity, RF24SN_CLIENT_INACTIVE_TIMEOUT)){
-
-				IF_RF24SN_DEBUG(
-					Serial.print(F("Clnt t/o: "));
-					Serial.println(clients[clientIndex].clientId, DEC);
-				);
-				RF24SNGateway::resetClient(clientIndex);
-			}
-		}
-	}
+void RF24SNGatewayBase::setDeliveryHandler(deliveryHandler onDeliveryHandler){
+	_onDeliveryHandler = onDeliveryHandler;
 }
 
-void RF24SNGateway::resetClient(byte clientIndex){
-	IF_RF24SN_DEBUG(
-		Serial.print(F("rst clnt : "));
-		Serial.println(clientIndex, DEC);
-	);
-	for(int topicIndex = 0 ; topicIndex < RF24SN_MAX_CLIENT_TOPICS; topicIndex++){
-		clients[clientIndex].topics[topicIndex].topicName[0] = '\0';
-	}
-	clients[clientIndex].clientId = RF24SN_CLIENT_EMPTY_ID;
-	clients[clientIndex].topicCount = 0;
+void RF24SNGatewayBase::setEpochStorage(RF24SNStorage* storage){
+	_epochStorage = storage;
 }
 
-void RF24SNGateway::resetClients(void){
-	for(int clientIndex = 0 ; clientIndex < RF24SN_MAX_CLIENTS; clientIndex++){
-		RF24SNGateway::resetClient(clientIndex);
-	}
-}
+void RF24SNGatewayBase::begin(void){
+	RF24SN::begin();
 
-byte RF24SNGateway::findClient(uint16_t clientId){
-	byte clientIndex = RF24SN_CLIENT_NOT_FOUND_IDX;
-	for(byte idx = 0 ; idx < RF24SN_MAX_CLIENTS; idx++){
-		if(clients[idx].clientId == clientId){
-			clientIndex = idx;
-			break;
+	// Count the boot, sessions of a previous run must never match a new one
+	if(_epochStorage != NULL){
+		RF24SNGatewayEpoch stored;
+		if(!_epochStorage->read(0, &stored, sizeof(RF24SNGatewayEpoch)) || stored.magic != RF24SN_GATEWAY_EPOCH_MAGIC){
+			stored.epoch = 0;
 		}
-	}
-	return clientIndex;
-}
-
-byte RF24SNGateway::registerClient(uint16_t clientId){
-	IF_RF24SN_DEBUG(Serial.println(F("Clnt reg : ")););
-	byte clientIndex = RF24SN_CLIENT_NOT_FOUND_IDX;
-	for(byte idx = 0 ; idx < RF24SN_MAX_CLIENTS; idx++){
-		// See if we've got a free slot
-		if(clients[idx].clientId == RF24SN_CLIENT_EMPTY_ID){
-			clients[idx].clientId = clientId;
-			clientIndex = idx;
-			break;
+		stored.magic = RF24SN_GATEWAY_EPOCH_MAGIC;
+		stored.epoch++;
+		if(stored.epoch == 0){
+			stored.epoch = 1;
 		}
+		_epoch = _epochStorage->write(0, &stored, sizeof(RF24SNGatewayEpoch)) ? stored.epoch : 0;
+		IF_RF24SN_DEBUG(Serial.print(F("Epoch ")); Serial.println(_epoch););
 	}
+}
 
-	if(clientIndex == RF24SN_CLIENT_NOT_FOUND_IDX){
-		IF_RF24SN_DEBUG(Serial.println(F("Clnt mx")););
+uint32_t RF24SNGatewayBase::nextSession(void){
+	if(_epoch == 0){
+		return 0;
 	}
-	else {
-		IF_RF24SN_DEBUG(
-			Serial.print(F("Clnt reg : "));
-			Serial.println(clientIndex, DEC);
-		);
+	if(++_lastRegistration == 0){
+		_lastRegistration = 1;
 	}
-	return clientIndex;
+	return ((uint32_t)_epoch << 16) | _lastRegistration;
 }
 
-void RF24SNGateway::handleSubscribe(void)
-{
-	RF24NetworkHeader header;
-	RF24SNSubscribeRequest subscribeRequest;
-
-	// Read the full request
-	_network->read(header, &subscribeRequest, sizeof(RF24SNSubscribeRequest));
-
-	IF_RF24SN_DEBUG(
-		Serial.print(F("Sbcr "));
-		Serial.print(header.from_node);
-		Serial.print(F(" - "));
-		Serial.println(subscribeRequest.topicName);
-	);
-
-	// Try and find existing client
-	byte clientIndex = RF24SNGateway::findClient(header.from_node);
-
-	IF_RF24SN_DEBUG(
-		Serial.print(F("Clnt fnd: "));
-		Serial.println(clientIndex, DEC);
-	);
-
-	// register new client
-	if(clientIndex == RF24SN_CLIENT_NOT_FOUND_IDX){
-		clientIndex = RF24SNGateway::registerClient(header.from_node);
-
-		// If clientIdx is still -1 there is no more space for clients
-		if(clientIndex == -1){
-			return;
-		}
+uint16_t RF24SNGatewayBase::hashTopic(const char* topic){
+	uint16_t hash = 5381;
+	while(*topic != '\0'){
+		hash = (hash << 5) + hash + (uint8_t)*topic++;
 	}
+	return hash;
+}
 
-	// Update the last time we got a request from the client
-	clients[clientIndex].lastActivity = millis();
-
-	// Id of the topic to return to the client
-	byte topicId = 0;
-
-	// Index of the topic for the current client
-	int topicIndex = 0;
-
-	// Flag if we have found the topic
-	bool foundTopic = false;
+bool RF24SNGatewayBase::isFilter(const char* topic){
+	return strchr(topic, '+') != NULL || strchr(topic, '#') != NULL;
+}
 
-	// Try and find existing topic
-	for( ; topicIndex < clients[clientIndex].topicCount; topicIndex++){
-		if(strcmp(clients[clientIndex].topics[topicIndex].topicName, subscribeRequest.topicName) == 0){
-			foundTopic = true;
-			break;
+bool RF24SNGatewayBase::isValidFilter(const char* filter){
+	for(const char* c = filter ; *c != '\0'; c++){
+		bool levelStart = (c == filter || c[-1] == '/');
+		bool levelEnd = (c[1] == '\0' || c[1] == '/');
+		if(*c == '+' && !(levelStart && levelEnd)){
+			return false;
 		}
-	}
-	IF_RF24SN_DEBUG(
-		Serial.print(F("tpc fnd: "));
-		Serial.println(foundTopic);
-	);
-	// Register new topic
-	if(!foundTopic){
-		if(clients[clientIndex].topicCount < RF24SN_MAX_CLIENT_TOPICS){
-			// Subscribe to the new topic
-			bool subscribed = _onSubsribeHandler(subscribeRequest.topicName);
-			if(subscribed){
-				clients[clientIndex].topicCount = clients[clientIndex].topicCount + 1;
-				strcpy(clients[clientIndex].topics[topicIndex].topicName, subscribeRequest.topicName);
-				clients[clientIndex].topics[topicIndex].topicId = topicIndex+1;
-				topicId = clients[clientIndex].topics[topicIndex].topicId;
-				IF_RF24SN_DEBUG(
-					Serial.print(F("Tpc reg : "));
-					Serial.println(topicId, DEC);
-				);
-			}
-			else{
-				IF_RF24SN_DEBUG(
-					Serial.println(F("Tpc reg f"));
-				);
-				return; // TODO implement below
-				//				RF24NetworkHeader responseHeader(header.from_node, RF24SN_SUBNACK);
-				//				_network->write(responseHeader, NULL, 0);
-			}
-		}else{
-			IF_RF24SN_DEBUG(Serial.println(F("tpc mx")););
-			// TODO implement below
-			//			RF24NetworkHeader responseHeader(header.from_node, RF24SN_SUBNACK);
-			//			_network->write(responseHeader, NULL, 0);
-			return;
+		if(*c == '#' && !(levelStart && c[1] == '\0')){
+			return false;
 		}
 	}
-	// We already have this topic
-	else{
-		topicId = clients[clientIndex].topics[topicIndex].topicId;
-	}
-	IF_RF24SN_DEBUG(
-		Serial.print(F("tpc id: "));
-		Serial.println(topicId);
-	);
-	// Send back ack
-	delay(100);
-	RF24SNSubscribeResponse response;
-	response.topicId = topicId;
-	RF24NetworkHeader responseHeader(header.from_node, RF24SN_SUBACK);
-	_network->write(responseHeader, &response, sizeof(RF24SNSubscribeResponse));
-}
-
-void RF24SNGateway::updateClientActivity(uint16_t clientId){
-	// Try and find existing client
-	byte clientIndex = RF24SNGateway::findClient(clientId);
-	if(clientIndex != RF24SN_CLIENT_NOT_FOUND_IDX){
-		clients[clientIndex].lastActivity = millis();
-	}
+	return true;
 }
 
-bool RF24SNGateway::handleMessage(bool swallowInvalid){
-	RF24NetworkHeader header;
-	_network->peek(header);
-	updateClientActivity(header.from_node);
-
-	bool handled = RF24SN::handleMessage(false);
-
-	if(!handled){
-		if(header.type == RF24SN_SUBSCRIBE){
-			RF24SNGateway::handleSubscribe();
-			handled = true;
+bool RF24SNGatewayBase::matchFilter(const char* filter, const char* topic){
+	while(*filter != '\0'){
+		if(*filter == '#'){
+			return true;
+		}
+		if(*filter == '+'){
+			while(*topic != '\0' && *topic != '/'){
+				topic++;
+			}
+			filter++;
+			continue;
+		}
+		// 'a/#' also matches 'a'
+		if(*topic == '\0' && filter[0] == '/' && filter[1] == '#'){
+			return true;
 		}
-		else if(swallowInvalid){
-			RF24NetworkHeader requestHeader;
-			_network->read(requestHeader, NULL, 0);
+		if(*filter != *topic){
+			return false;
 		}
+		filter++;
+		topic++;
 	}
-	return handled;
+	return *topic == '\0';
 }
 
-bool RF24SNGateway::checkSubscription(const char* topic, float value){
-	IF_RF24SN_DEBUG(
-		Serial.print(F("chk sbr "));
-		Serial.println(topic);
-	);
-	bool hasClient = false;
-	for(int clientIndex = 0 ; clientIndex < RF24SN_MAX_CLIENTS; clientIndex++){
-		IF_RF24SN_DEBUG(
-			Serial.print(F(" cidx "));
-			Serial.print(clientIndex, DEC);
-			Serial.print(F(" tpcs "));
-			Serial.println(clients[clientIndex].topicCount, DEC);
-		);
-		for(int topicIndex = 0 ; topicIndex < clients[clientIndex].topicCount; topicIndex++){
-
-			if(strcmp(clients[clientIndex].topics[topicIndex].topicName, topic) == 0){
-				IF_RF24SN_DEBUG(
-					Serial.print(F("fwd sbr "));
-					Serial.print(clients[clientIndex].clientId, DEC);
-					Serial.print(F(" tpc "));
-					Serial.println(clients[clientIndex].topics[topicIndex].topicId, DEC);
-					Serial.print(F(" cid "));
-					Serial.println(clients[clientIndex].clientId, DEC);
-				);
-				RF24SNPacket requestPacket{clients[clientIndex].topics[topicIndex].topicId, value};
-				bool success = sendRequest(clients[clientIndex].clientId, RF24SN_PUBLISH, &requestPacket, sizeof(RF24SNPacket), NULL, 0, 3);
-				IF_RF24SN_DEBUG(
-					Serial.print(F("fwd s "));
-					Serial.println(success, DEC);
-				);
-				hasClient = true;
-			}
-		}
+uint16_t RF24SNGatewayBase::hashLevel(const char* level, uint8_t& length){
+	uint16_t hash = 5381;
+	length = 0;
+	while(level[length] != '\0' && level[length] != '/'){
+		hash = (hash << 5) + hash + (uint8_t)level[length++];
 	}
-	return hasClient;
+	return hash;
 }
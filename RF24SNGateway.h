@@ -3,6 +3,13 @@
 
 #include "RF24SN.h"
 
+// Linux gateways take values from the broker thread through a lock free queue
+#if defined(__linux__) && !defined(ARDUINO)
+#define RF24SN_HAS_INGRESS
+#include <atomic>
+#include "RF24SNSpscQueue.h"
+#endif
+
 // Maximum number of clients that can be registered
 #ifndef RF24SN_MAX_CLIENTS
 #define RF24SN_MAX_CLIENTS 2
@@ -19,82 +26,616 @@
 #endif
 
 
+// Time without any messages before a client is probed with a PINGREQ
+#ifndef RF24SN_CLIENT_PROBE_TIMEOUT
+#define RF24SN_CLIENT_PROBE_TIMEOUT (RF24SN_CLIENT_INACTIVE_TIMEOUT / 2)
+#endif
+
 // Timeout before checking for inactive clients
 #ifndef RF24SN_CLIENT_INACTIVE_DELAY
 #define RF24SN_CLIENT_INACTIVE_DELAY 10000
 #endif
 
+// Number of slots in the client address table, must be larger than RF24SN_MAX_CLIENTS
+#ifndef RF24SN_CLIENT_BUCKETS
+#define RF24SN_CLIENT_BUCKETS (RF24SN_MAX_CLIENTS * 2)
+#endif
+
+// Number of values that can be waiting to be sent to the clients
+#ifndef RF24SN_MAX_QUEUED_VALUES
+#define RF24SN_MAX_QUEUED_VALUES 4
+#endif
+
+// Values the broker thread can post before update() takes them, must be a power of two
+#ifndef RF24SN_INGRESS_QUEUE_SIZE
+#define RF24SN_INGRESS_QUEUE_SIZE 64
+#endif
+
+// Values sent to the clients in a single update(), acks are always sent first
+#ifndef RF24SN_TX_FRAMES_PER_UPDATE
+#define RF24SN_TX_FRAMES_PER_UPDATE 4
+#endif
+
+// Bytes a client may send per round of the scheduler, a frame costs its length including the header
+#ifndef RF24SN_TX_QUANTUM
+#define RF24SN_TX_QUANTUM MAX_FRAME_SIZE
+#endif
+
+// Values sent to a single client that may be waiting for an ack at the same time
+#ifndef RF24SN_CLIENT_MAX_IN_FLIGHT
+#define RF24SN_CLIENT_MAX_IN_FLIGHT 1
+#endif
+
+// Values per second that can be sent to a single client, 0 for no limit
+#ifndef RF24SN_CLIENT_TX_RATE
+#define RF24SN_CLIENT_TX_RATE 20
+#endif
+
+// Values that can be sent to a single client in a burst after it was quiet
+#ifndef RF24SN_CLIENT_TX_BURST
+#define RF24SN_CLIENT_TX_BURST 4
+#endif
+
+// Size of the receive buffer of the gateway, must hold the largest bulk subscribe
+#ifndef RF24SN_GATEWAY_RX_BUFFER_SIZE
+#define RF24SN_GATEWAY_RX_BUFFER_SIZE RF24SN_SUBSCRIBE_MANY_SIZE
+#endif
+
+static_assert(RF24SN_GATEWAY_RX_BUFFER_SIZE >= RF24SN_RX_BUFFER_SIZE, "RF24SN_GATEWAY_RX_BUFFER_SIZE must hold what a node can receive");
+
+// What to drop when the queue of a client is full
+#define RF24SN_QUEUE_DROP_OLDEST 0
+#define RF24SN_QUEUE_DROP_NEWEST 1
+
 #define RF24SN_CLIENT_EMPTY_ID 65535
-#define RF24SN_CLIENT_NOT_FOUND_IDX 255
+
+// Maximum number of distinct topics the clients can register for together
+#ifndef RF24SN_MAX_TOPICS
+#define RF24SN_MAX_TOPICS (RF24SN_MAX_CLIENTS * RF24SN_MAX_CLIENT_TOPICS)
+#endif
+
+// Number of hash buckets in the topic index, must be a power of two
+#ifndef RF24SN_TOPIC_BUCKETS
+#define RF24SN_TOPIC_BUCKETS RF24SNPowerOfTwo<(RF24SN_MAX_TOPICS + 1) / 2>::value
+#endif
+
+// Number of values that can be waiting for a single client
+#ifndef RF24SN_MAX_CLIENT_QUEUE
+#define RF24SN_MAX_CLIENT_QUEUE RF24SNFairShare<RF24SN_MAX_QUEUED_VALUES, RF24SN_MAX_CLIENTS>::value
+#endif
+
+// Number of nodes in the wildcard filter trie, every filter level that is not shared takes a node
+#ifndef RF24SN_MAX_FILTER_NODES
+#define RF24SN_MAX_FILTER_NODES (RF24SN_MAX_TOPICS * 2)
+#endif
+
+// Kinds of filter levels
+#define RF24SN_FILTER_LEVEL 0 // Matches a level by name
+#define RF24SN_FILTER_SINGLE 1 // '+', matches any single level
+#define RF24SN_FILTER_MULTI 2 // '#', matches all remaining levels
 
 /**
- * A struct representing a topic that has been registered
+ * A struct stored to count the boots of the gateway
  */
-struct RF24SNTopicRegistration {
+struct __attribute__((__packed__))  RF24SNGatewayEpoch{
 	/**
-	 * Name of the topic on the MQTT protocol
+	 * RF24SN_GATEWAY_EPOCH_MAGIC if the storage holds an epoch
 	 */
-	char topicName[RF24SN_TOPIC_LENGTH];
+	uint16_t magic;
 
 	/**
-	 * ID of the topic on the RF24SN protocol
+	 * Number of times the gateway started, never 0
 	 */
-	uint8_t topicId = 0;
+	uint16_t epoch;
 };
 
+// Marks storage that holds the gateway epoch
+#define RF24SN_GATEWAY_EPOCH_MAGIC 0x4745
+
 /**
- * A struct representing a registered client
+ * Called when a client topic need to be subscribed
  */
-struct RF24SNClient{
-	/**
-	 * ID of the client
-	 */
-	uint16_t clientId = 0;
+typedef bool (*subsribeHandler)(const char* topic);
+
+/**
+ * Called when the last client registered for a topic is removed
+ */
+typedef void (*unsubscribeHandler)(const char* topic);
+
+/**
+ * Called when a value forwarded to a client was acked, or dropped after it could not be delivered
+ */
+typedef void (*deliveryHandler)(uint16_t clientId, uint8_t topicId, bool delivered);
 
+#ifdef RF24SN_HAS_INGRESS
+/**
+ * Counters of the values posted to a gateway with postSubscription()
+ */
+struct RF24SNIngressStats{
 	/**
-	 * Last time this client responded
+	 * Values taken into the queue
 	 */
-	uint32_t lastActivity = 0;
+	uint32_t posted = 0;
 
 	/**
-	 * Array of registered topics for this client
+	 * Values dropped because the queue was full
 	 */
-	RF24SNTopicRegistration topics[RF24SN_MAX_CLIENT_TOPICS];
+	uint32_t overflows = 0;
 
 	/**
-	 * Number of topics that the client has registered
+	 * Values replaced by a newer value of the same topic before they were forwarded
+	 * Only counted for topics a client registered for by name, the values of other
+	 * topics are replaced in the queues of the clients
 	 */
-	byte topicCount = 0;
+	uint32_t coalesced = 0;
 };
+#endif
 
 /**
- * Called when a client topic need to be subscribed
+ * Picks the smallest unsigned type that can index a table of Capacity entries
+ * The largest value of the type is kept free to mark a missing entry
  */
-typedef bool (*subsribeHandler)(const char* topic);
+template<bool Small> struct RF24SNIndexType { typedef uint8_t type; };
+template<> struct RF24SNIndexType<false> { typedef uint16_t type; };
+
+template<uint32_t Capacity> struct RF24SNIndex {
+	typedef typename RF24SNIndexType<(Capacity < 255)>::type type;
+	enum { NONE = (Capacity < 255) ? 255 : 65535 };
+};
 
 /**
- * A class representing a gateway on a RF24SN Network
+ * Smallest power of two that is at least Value
  */
-class RF24SNGateway : public RF24SN {
+template<uint32_t Value, uint32_t Power = 1, bool Done = (Power >= Value)> struct RF24SNPowerOfTwo {
+	enum { value = RF24SNPowerOfTwo<Value, Power * 2>::value };
+};
+template<uint32_t Value, uint32_t Power> struct RF24SNPowerOfTwo<Value, Power, true> {
+	enum { value = Power };
+};
+
+/**
+ * Share of Total for each of Count users, rounded up and limited to 255
+ */
+template<uint32_t Total, uint32_t Count> struct RF24SNFairShare {
+	enum { value = (Total + Count - 1) / Count > 255 ? 255 : (Total + Count - 1) / Count };
+};
+
+/**
+ * The part of the gateway that does not depend on the size of its tables
+ */
+class RF24SNGatewayBase : public RF24SN {
 public:
+	/**
+	 * Begin the gateway
+	 */
+	void begin(void);
 
 	/**
-	 * Creates a new instance of the gateway
+	 * Sets the handler to call for every forwarded value once it was acked or dropped
+	 * Values a client did not ack are parked until the client is active again, they
+	 * are only dropped when its queue overflows or the client is removed
+	 * A value replaced by a newer one of the same topic before it was sent is not reported
 	 */
-	RF24SNGateway(RF24* radio, RF24Network* network, RF24SNConfig* config, messageHandler onMessageHandler, subsribeHandler onSubsribeHandler);
+	void setDeliveryHandler(deliveryHandler onDeliveryHandler);
 
 	/**
-	 * Begin the gateway
+	 * Sets the handler to call when no client is registered for a topic anymore
 	 */
-	void begin(void);
+	void setUnsubscribeHandler(unsubscribeHandler onUnsubscribeHandler);
+
+	/**
+	 * Sets what to drop when more values are waiting for a client than fit its queue
+	 * @param policy RF24SN_QUEUE_DROP_OLDEST (default) or RF24SN_QUEUE_DROP_NEWEST
+	 */
+	void setQueuePolicy(uint8_t policy);
+
+	/**
+	 * Keeps a boot counter in storage, needed to give out client sessions
+	 * A session combines the boot counter with a registration counter, so clients
+	 * can tell if the topic ids they cached are still known after a reboot
+	 * Must be called before begin()
+	 */
+	void setEpochStorage(RF24SNStorage* storage);
+
+	/**
+	 * True if the topic name has wildcards
+	 */
+	static bool isFilter(const char* topic);
+
+	/**
+	 * True if a topic matches a filter
+	 */
+	static bool matchFilter(const char* filter, const char* topic);
+
+	/**
+	 * Hash a topic name for the topic index
+	 */
+	static uint16_t hashTopic(const char* topic);
+
+protected:
+	RF24SNGatewayBase(RF24* radio, RF24Network* network, RF24SNConfig* config, messageHandler onMessageHandler, subsribeHandler onSubsribeHandler);
+
+	/**
+	 * Handler when a SN client requests to subscribe for a topic
+	 */
+	subsribeHandler _onSubsribeHandler;
+
+	/**
+	 * Handler when the last client registered for a topic is removed
+	 */
+	unsubscribeHandler _onUnsubscribeHandler;
+
+	/**
+	 * Handler to report forwarded values to
+	 */
+	deliveryHandler _onDeliveryHandler;
+
+	/**
+	 * One of RF24SN_QUEUE_DROP_*
+	 */
+	uint8_t _queuePolicy;
+
+	/**
+	 * Storage of the boot counter, NULL if sessions are disabled
+	 */
+	RF24SNStorage* _epochStorage;
+
+	/**
+	 * Boot counter of this run, 0 if sessions are disabled
+	 */
+	uint16_t _epoch;
+
+	/**
+	 * Number of clients registered in this run, the low half of the next session
+	 */
+	uint16_t _lastRegistration;
+
+	/**
+	 * Receive buffer of the gateway, replaces the smaller one of a node
+	 */
+	uint8_t _gatewayRxBuffer[RF24SN_GATEWAY_RX_BUFFER_SIZE + 1];
+
+	/**
+	 * Session for a client that registers now, 0 if sessions are disabled
+	 */
+	uint32_t nextSession(void);
+
+
+	/**
+	 * True if the wildcards only take up full levels, and '#' is last
+	 */
+	static bool isValidFilter(const char* filter);
+
+	/**
+	 * Hash a single level of a topic name
+	 * @param length Receives the length of the level
+	 */
+	static uint16_t hashLevel(const char* level, uint8_t& length);
+};
+
+/**
+ * A gateway on a RF24SN Network, with all tables sized at compile time
+ * Index types are as small as the capacity allows, a uint8_t up to 254 entries
+ * Use RF24SNGateway for the size set by the RF24SN_MAX_* macros
+ * @param MaxClients Number of clients that can be registered
+ * @param MaxClientTopics Number of topics a client can register for
+ * @param TopicLen Longest topic name the gateway keeps, including the terminator
+ * @param MaxTopics Number of distinct topics the clients can register for together
+ * @param MaxQueuedValues Number of values that can be waiting to be sent to the clients
+ * @param ClientBuckets Number of slots in the client address table, must be larger than MaxClients
+ * @param TopicBuckets Number of hash buckets in the topic index, a power of two, about two topics per bucket by default
+ * @param MaxClientQueue Number of values that can be waiting for a single client, its share of MaxQueuedValues by default
+ * @param MaxFilterNodes Number of nodes in the wildcard filter trie, every filter level that is not shared takes a node
+ */
+template<uint16_t MaxClients, uint8_t MaxClientTopics, uint8_t TopicLen = RF24SN_TOPIC_LENGTH,
+	uint16_t MaxTopics = MaxClients * MaxClientTopics, uint16_t MaxQueuedValues = RF24SN_MAX_QUEUED_VALUES,
+	uint16_t ClientBuckets = MaxClients * 2, uint16_t TopicBuckets = RF24SNPowerOfTwo<(MaxTopics + 1) / 2>::value,
+	uint8_t MaxClientQueue = RF24SNFairShare<MaxQueuedValues, MaxClients>::value, uint16_t MaxFilterNodes = MaxTopics * 2>
+class RF24SNGatewayT : public RF24SNGatewayBase {
+	static_assert(MaxClients > 0 && MaxClients < 65535, "MaxClients must be between 1 and 65534");
+	static_assert(MaxClientTopics > 0, "MaxClientTopics must be at least 1");
+	static_assert(TopicLen > 1, "TopicLen must leave room for a name");
+	static_assert(MaxTopics > 0 && MaxTopics < 65535, "MaxTopics must be between 1 and 65534");
+	static_assert((uint32_t)MaxClients * MaxClientTopics < 65535, "MaxClients * MaxClientTopics must be below 65535");
+	static_assert(MaxQueuedValues > 0 && MaxQueuedValues < 65535, "MaxQueuedValues must be between 1 and 65534");
+	static_assert(ClientBuckets > MaxClients, "ClientBuckets must be larger than MaxClients");
+	static_assert(TopicBuckets > 0 && (TopicBuckets & (TopicBuckets - 1)) == 0, "TopicBuckets must be a power of two");
+	static_assert(MaxClientQueue > 0, "MaxClientQueue must be at least 1");
+	static_assert(MaxFilterNodes > 0 && MaxFilterNodes < 65535, "MaxFilterNodes must be between 1 and 65534");
+
+public:
+	/**
+	 * Index of a client, sized to fit all clients
+	 */
+	typedef typename RF24SNIndex<MaxClients>::type ClientIndex;
+
+	/**
+	 * Index of a topic registration over all clients, sized to fit all registrations
+	 */
+	typedef typename RF24SNIndex<(uint32_t)MaxClients * MaxClientTopics>::type TopicSlot;
+
+	/**
+	 * Index of a topic in the topic table, sized to fit all topics
+	 */
+	typedef typename RF24SNIndex<MaxTopics>::type TopicIndex;
+
+	/**
+	 * Index of a queued value, sized to fit all values
+	 */
+	typedef typename RF24SNIndex<MaxQueuedValues>::type QueueIndex;
+
+	/**
+	 * Index of a node of the wildcard filter trie, sized to fit all nodes
+	 */
+	typedef typename RF24SNIndex<MaxFilterNodes>::type FilterNodeIndex;
+
+	enum {
+		CLIENT_NOT_FOUND_IDX = RF24SNIndex<MaxClients>::NONE,
+		TOPIC_SLOT_NONE = RF24SNIndex<(uint32_t)MaxClients * MaxClientTopics>::NONE,
+		TOPIC_NOT_FOUND_IDX = RF24SNIndex<MaxTopics>::NONE,
+		QUEUE_NONE = RF24SNIndex<MaxQueuedValues>::NONE,
+		FILTER_NODE_NONE = RF24SNIndex<MaxFilterNodes>::NONE
+	};
+
+	/**
+	 * A struct representing one level of the wildcard filters
+	 */
+	struct FilterNode {
+		/**
+		 * Hash of the level name, matches are checked against the full filter
+		 */
+		uint16_t levelHash = 0;
+
+		/**
+		 * One of RF24SN_FILTER_*
+		 */
+		uint8_t kind = RF24SN_FILTER_LEVEL;
+
+		/**
+		 * Topic of the filter that ends at this level
+		 */
+		TopicIndex topic = TOPIC_NOT_FOUND_IDX;
+
+		/**
+		 * Level before this one, FILTER_NODE_NONE for a first level
+		 */
+		FilterNodeIndex parent = FILTER_NODE_NONE;
+
+		/**
+		 * First level below this one
+		 */
+		FilterNodeIndex firstChild = FILTER_NODE_NONE;
+
+		/**
+		 * Next level with the same parent, or the next free node
+		 */
+		FilterNodeIndex nextSibling = FILTER_NODE_NONE;
+	};
+
+	/**
+	 * A struct representing a topic that one or more clients registered for
+	 */
+	struct Topic {
+		/**
+		 * Name of the topic on the MQTT protocol, may be a filter with '+' and '#' wildcards
+		 */
+		char topicName[TopicLen];
+
+		/**
+		 * Hash of the topic name, compared before the name itself
+		 */
+		uint16_t topicHash = 0;
+
+		/**
+		 * Number of client registrations for the topic, 0 if the topic is free
+		 */
+		TopicSlot refCount = 0;
+
+		/**
+		 * Next topic in the same topic index bucket, or the next free topic
+		 */
+		TopicIndex nextInBucket = TOPIC_NOT_FOUND_IDX;
+
+		/**
+		 * First client registration for the topic
+		 */
+		TopicSlot firstSubscriber = TOPIC_SLOT_NONE;
+
+		/**
+		 * Last value the broker published for the topic, sent to clients that subscribe
+		 * Not kept for filters, they match many topics
+		 */
+		float lastValue = 0;
+		bool hasValue = false;
+
+#ifdef RF24SN_HAS_INGRESS
+		/**
+		 * Newest value posted for the topic while it waits in takePostedValues()
+		 */
+		float postedValue = 0;
+		TopicIndex nextPosted = TOPIC_NOT_FOUND_IDX;
+		bool posted = false;
+#endif
+	};
+
+	/**
+	 * A struct representing a topic that a client registered for
+	 */
+	struct TopicRegistration {
+		/**
+		 * Topic in the topic table
+		 */
+		TopicIndex topic = TOPIC_NOT_FOUND_IDX;
+
+		/**
+		 * ID of the topic on the RF24SN protocol
+		 */
+		uint8_t topicId = 0;
+
+		/**
+		 * Next client registration for the same topic
+		 */
+		TopicSlot nextSubscriber = TOPIC_SLOT_NONE;
+	};
+
+	/**
+	 * A struct representing a registered client
+	 */
+	struct Client{
+		/**
+		 * ID of the client
+		 */
+		uint16_t clientId = RF24SN_CLIENT_EMPTY_ID;
+
+		/**
+		 * Last time this client responded
+		 */
+		uint32_t lastActivity = 0;
+
+		/**
+		 * Client that was active just before this one, or the next free client
+		 */
+		ClientIndex prevActive = CLIENT_NOT_FOUND_IDX;
+
+		/**
+		 * Client that was active just after this one
+		 */
+		ClientIndex nextActive = CLIENT_NOT_FOUND_IDX;
+
+		/**
+		 * Array of registered topics for this client
+		 */
+		TopicRegistration topics[MaxClientTopics];
+
+		/**
+		 * Number of topics that the client has registered
+		 */
+		byte topicCount = 0;
+
+		/**
+		 * True while a PINGREQ to check if the client is still alive is in flight
+		 */
+		bool probing = false;
+
+		/**
+		 * Session given out when the client registered, 0 if sessions are disabled
+		 */
+		uint32_t session = 0;
+
+		/**
+		 * Oldest and newest value waiting to be sent to the client
+		 */
+		QueueIndex queueHead = QUEUE_NONE;
+		QueueIndex queueTail = QUEUE_NONE;
+
+		/**
+		 * Number of values waiting to be sent to the client
+		 */
+		uint8_t queueLength = 0;
+
+		/**
+		 * Neighbours in the ring of clients with queued values
+		 */
+		ClientIndex prevReady = CLIENT_NOT_FOUND_IDX;
+		ClientIndex nextReady = CLIENT_NOT_FOUND_IDX;
+
+		/**
+		 * True if a value was not acked, nothing is sent until the client is active again
+		 */
+		bool away = false;
+
+		/**
+		 * Values sent to the client that are waiting for an ack
+		 */
+		uint8_t inFlight = 0;
+
+		/**
+		 * Bytes the client may still send in this round of the scheduler
+		 */
+		uint16_t deficit = 0;
+
+		/**
+		 * Values that may be sent before the rate limit applies
+		 */
+		uint8_t tokens = RF24SN_CLIENT_TX_BURST;
+
+		/**
+		 * Last time a token was added
+		 */
+		uint32_t lastRefill = 0;
+
+		/**
+		 * Duty cycle announced by the client, values are held back outside its wake window
+		 */
+		uint32_t sleepInterval = 0;
+		uint16_t wakeWindow = 0;
+	};
+
+	/**
+	 * A struct representing a value waiting to be sent to a client
+	 */
+	struct QueuedValue{
+		/**
+		 * RF24SN_PUBLISH or RF24SN_PUBLISH_TOPIC
+		 */
+		uint8_t messageType = 0;
+
+		/**
+		 * Request data, starting with the topic id
+		 */
+		uint8_t payload[RF24SN_MAX_REQUEST_SIZE];
+
+		/**
+		 * Length of the request data
+		 */
+		uint8_t payloadLength = 0;
+
+		/**
+		 * Next value for the same client, or the next free value
+		 */
+		QueueIndex next = QUEUE_NONE;
+	};
+
+	/**
+	 * Creates a new instance of the gateway
+	 */
+	RF24SNGatewayT(RF24* radio, RF24Network* network, RF24SNConfig* config, messageHandler onMessageHandler, subsribeHandler onSubsribeHandler);
 
 	void update(void);
 
+	/**
+	 * Like RF24SN::getUpdateTimeout(), also takes the queued values and the check
+	 * of inactive clients into account, visits the clients with queued values
+	 */
+	uint32_t getUpdateTimeout(void);
+
 	/**
 	 * Check which clients are subscribed to the topic, and forward the value to them
+	 * Clients subscribed with a wildcard filter get a RF24SN_PUBLISH_TOPIC with the topic name
+	 * The value is queued for every client and written from update(), together
+	 * with the acks and retries. It is also kept for clients that register later
+	 *
+	 * Touches the client tables, so it must be called from the thread that calls update()
+	 *
+	 * @return True if at least one client is subscribed to the topic
 	 */
 	bool checkSubscription(const char* topic, float value);
 
+#ifdef RF24SN_HAS_INGRESS
+	/**
+	 * Queues a value for checkSubscription() from the next update(), without blocking
+	 * May be called from one other thread, like the callback of the broker client
+	 * Only the newest value of a topic is forwarded when several are waiting
+	 *
+	 * @return False if the queue is full or the topic name too long
+	 */
+	bool postSubscription(const char* topic, float value);
+
+	/**
+	 * Counters of postSubscription(), may be read from any thread
+	 */
+	RF24SNIngressStats getIngressStats(void);
+#endif
 
 	/**
 	 * Clears all registered clients
@@ -103,14 +644,105 @@ public:
 protected:
 
 	/**
-	 * Handler when a SN client requests to subscribe for a topic
+	 * Values waiting to be sent to the clients
 	 */
-	subsribeHandler _onSubsribeHandler;
+	QueuedValue queuedValues[MaxQueuedValues];
+
+#ifdef RF24SN_HAS_INGRESS
+	/**
+	 * A value posted by the broker thread
+	 */
+	struct PostedValue{
+		// Long enough for any registered topic and any topic sent along with a filter match
+		char topic[TopicLen > RF24SN_TOPIC_LENGTH ? TopicLen : RF24SN_TOPIC_LENGTH];
+		float value;
+	};
+
+	/**
+	 * Values posted by the broker thread, taken by update()
+	 */
+	RF24SNSpscQueue<PostedValue, RF24SN_INGRESS_QUEUE_SIZE> _ingress;
+
+	std::atomic<uint32_t> _ingressPosted;
+	std::atomic<uint32_t> _ingressOverflows;
+	std::atomic<uint32_t> _ingressCoalesced;
+#endif
+
+	/**
+	 * First unused value, the free values are chained through next
+	 */
+	QueueIndex freeQueuedValue;
+
+	/**
+	 * Client with queued values the next round of the scheduler starts with,
+	 * CLIENT_NOT_FOUND_IDX if no value is queued
+	 */
+	ClientIndex _nextTxClient;
+
+	/**
+	 * Number of clients in the ring of clients with queued values
+	 */
+	ClientIndex _readyClients;
+
+	/**
+	 * Probe of a quiet client, RF24SN_INVALID_HANDLE if none is in flight
+	 */
+	uint8_t _probeHandle;
 
 	/**
 	 * Reference to the clients connected to this gateway
 	 */
-	RF24SNClient clients[RF24SN_MAX_CLIENTS];
+	Client clients[MaxClients];
+
+	/**
+	 * Open addressed table of client indexes, keyed by node address
+	 */
+	ClientIndex clientBuckets[ClientBuckets];
+
+	/**
+	 * Least recently active client, checked first for inactivity
+	 */
+	ClientIndex oldestClient;
+
+	/**
+	 * Most recently active client
+	 */
+	ClientIndex newestClient;
+
+	/**
+	 * First unused client, the free clients are chained through prevActive
+	 */
+	ClientIndex freeClient;
+
+	/**
+	 * Topics the clients registered for, shared between the clients
+	 */
+	Topic topicTable[MaxTopics];
+
+	/**
+	 * First unused topic, the free topics are chained through nextInBucket
+	 */
+	TopicIndex freeTopic;
+
+	/**
+	 * Topic index, first topic in each bucket
+	 */
+	TopicIndex topicBuckets[TopicBuckets];
+
+	/**
+	 * Trie of the wildcard filters, one node per level
+	 */
+	FilterNode filterNodes[MaxFilterNodes];
+
+	/**
+	 * First node of the first filter levels
+	 */
+	FilterNodeIndex filterRoot;
+
+	/**
+	 * First unused node, the free nodes are chained through nextSibling
+	 */
+	FilterNodeIndex freeFilterNode;
 
 	/**
 	 * Last time inactive clients was tested
@@ -123,20 +755,224 @@ protected:
 	void handleSubscribe(void);
 
 	/**
-	 * Handles any incomming message
+	 * Answer a ping with the session of the client
+	 */
+	void handlePingRequest(void);
+
+	/**
+	 * Handle a bulk subscribe request
+	 */
+	void handleSubscribeMany(void);
+
+	/**
+	 * Finds or registers the client sending a subscribe and marks it active
+	 * @return CLIENT_NOT_FOUND_IDX if there is no more space for clients
+	 */
+	ClientIndex subscribingClient(uint16_t clientId);
+
+	/**
+	 * Registers a client for a topic
+	 * @return The topic id for the client, RF24SN_RSP_FAILED if the topic could not be registered
+	 */
+	byte registerTopic(ClientIndex clientIndex, const char* topicName);
+
+	/**
+	 * Handles the frame in the receive buffer
 	 */
 	bool handleMessage(bool swallowInvalid = true);
 
+	/**
+	 * Looks up the gateway handler for a message type, before the handlers of RF24SN
+	 */
+	frameHandler getFrameHandler(uint8_t messageType);
+
+	/**
+	 * Reports forwarded values to the delivery handler and removes clients
+	 * that did not answer a probe
+	 */
+	void onRequestComplete(const RF24SNRequest& request, bool success, const void* response, uint16_t responseLength);
+
 private:
+	/**
+	 * Gateway handlers indexed by message type - RF24SN_FIRST_MSG_TYPE
+	 */
+	static const frameHandler gatewayFrameHandlers[RF24SN_MSG_TYPES];
+
 	void checkInactiveClients(void);
 
-	byte findClient(uint16_t clientId);
+	/**
+	 * Probes the next quiet client, one at a time and never with the last free request slot,
+	 * a dead client holds its slot through all retries and the values for the others need one
+	 */
+	void probeClients(void);
+
+	/**
+	 * False if the client powered its radio down, until its next wake window
+	 */
+	bool isListening(const Client& client);
+
+#ifdef RF24SN_HAS_INGRESS
+	/**
+	 * Forwards the posted values, the newest one of each topic
+	 */
+	void takePostedValues(void);
+#endif
+
+	ClientIndex findClient(uint16_t clientId);
 
-	byte registerClient(uint16_t clientId);
+	ClientIndex registerClient(uint16_t clientId);
 
-	void resetClient(byte clientIndex);
+	void resetClient(ClientIndex clientIndex);
 
 	void updateClientActivity(uint16_t clientId);
+
+	/**
+	 * Marks a client as active now, moving it to the end of the activity list
+	 */
+	void touchClient(ClientIndex clientIndex);
+
+	/**
+	 * Removes a client from the activity list
+	 */
+	void unlinkClient(ClientIndex clientIndex);
+
+	/**
+	 * Bucket where the lookup for a node address starts
+	 */
+	static uint16_t clientBucket(uint16_t clientId);
+
+	/**
+	 * Removes a client from the address table
+	 */
+	void unindexClient(ClientIndex clientIndex);
+
+	/**
+	 * Gets the registration stored in a topic slot
+	 */
+	TopicRegistration& topicSlot(TopicSlot slot);
+
+	/**
+	 * Looks up a topic in the topic table
+	 */
+	TopicIndex findTopic(const char* topic, uint16_t topicHash);
+
+	/**
+	 * Adds a topic to the topic table, subscribing to it upstream
+	 * @return The topic, TOPIC_NOT_FOUND_IDX if the table is full or the subscribe failed
+	 */
+	TopicIndex createTopic(const char* topic, uint16_t topicHash);
+
+	/**
+	 * Drops a reference to a topic, unsubscribing upstream when it was the last one
+	 */
+	void releaseTopic(TopicIndex topicIndex);
+
+	/**
+	 * Queues a value for a client, dropping a value if the queue is full
+	 * A value waiting for the same topic is replaced, only the newest one is sent
+	 * @param requeue True if the value was taken from the queue, it goes back in front
+	 */
+	void queueValue(ClientIndex clientIndex, uint8_t messageType, const void* payload, uint8_t payloadLength, bool requeue);
+
+	/**
+	 * Queues the last value of a topic for a client that just registered for it
+	 */
+	void queueLastValue(ClientIndex clientIndex, byte topicId);
+
+	/**
+	 * Removes a value from the queue of a client and reports it as not delivered
+	 * @param oldest True to drop the oldest value, false for the newest
+	 */
+	void dropQueuedValue(ClientIndex clientIndex, bool oldest);
+
+	/**
+	 * Adds a client whose queue is no longer empty to the ring of the scheduler,
+	 * it gets its turn after all clients that were ready before
+	 */
+	void linkReady(ClientIndex clientIndex);
+
+	/**
+	 * Removes a client whose queue became empty from the ring of the scheduler
+	 */
+	void unlinkReady(ClientIndex clientIndex);
+
+	/**
+	 * Sends queued values, round robin over the clients with queued values weighted
+	 * by frame size, within the rate limit and in flight limit of each client
+	 */
+	void scheduleTx(void);
+
+	/**
+	 * Adds the tokens for the time passed since the last refill
+	 */
+	static void refillTokens(Client& client);
+
+	/**
+	 * Writes a value to all clients registered for a topic
+	 * @param topic Name of the topic for a wildcard filter, NULL for a plain topic
+	 */
+	bool forwardValue(TopicIndex topicIndex, const char* topic, float value);
+
+	/**
+	 * checkSubscription() once the topic was looked up
+	 * @param topicIndex Topic in the topic table, TOPIC_NOT_FOUND_IDX if no client registered for it by name
+	 */
+	bool publishValue(TopicIndex topicIndex, const char* topic, float value);
+
+	/**
+	 * Finds the trie node where a filter ends, optionally adding the missing levels
+	 */
+	FilterNodeIndex findFilterNode(const char* filter, bool create);
+
+	/**
+	 * Frees a trie node and its parents, as long as they are not used by another filter
+	 */
+	void pruneFilterNode(FilterNodeIndex node);
+
+	/**
+	 * Adds a filter to the trie
+	 * @return False if the trie is full
+	 */
+	bool insertFilter(TopicIndex topicIndex, const char* filter);
+
+	/**
+	 * Removes a filter from the trie
+	 */
+	void removeFilter(TopicIndex topicIndex, const char* filter);
+
+	/**
+	 * Forwards a value to the filters matching the topic, starting at a level of the trie
+	 * @param node First trie node of the level
+	 * @param level Level of the topic name to match
+	 */
+	bool matchFilters(FilterNodeIndex node, const char* level, const char* topic, float value);
+
+	/**
+	 * Forwards a value to the clients of a filter if the filter really matches
+	 */
+	bool forwardFilterMatch(TopicIndex topicIndex, const char* topic, float value);
+
+	/**
+	 * Adds a client registration to the subscribers of its topic
+	 */
+	void indexTopic(ClientIndex clientIndex, byte topicIndex);
+
+	/**
+	 * Removes a client registration from the subscribers of its topic
+	 */
+	void unindexTopic(ClientIndex clientIndex, byte topicIndex);
 };
 
+#include "RF24SNGatewayImpl.h"
+
+/**
+ * The gateway sized by the RF24SN_MAX_* macros
+ */
+typedef RF24SNGatewayT<RF24SN_MAX_CLIENTS, RF24SN_MAX_CLIENT_TOPICS, RF24SN_TOPIC_LENGTH,
+	RF24SN_MAX_TOPICS, RF24SN_MAX_QUEUED_VALUES, RF24SN_CLIENT_BUCKETS, RF24SN_TOPIC_BUCKETS,
+	RF24SN_MAX_CLIENT_QUEUE, RF24SN_MAX_FILTER_NODES> RF24SNGateway;
+
+// Deprecated, use CLIENT_NOT_FOUND_IDX of the gateway type, which depends on its MaxClients
+#define RF24SN_CLIENT_NOT_FOUND_IDX RF24SNGateway::CLIENT_NOT_FOUND_IDX
+
 #endif
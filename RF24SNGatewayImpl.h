@@ -0,0 +1,1149 @@
+#ifndef RF24SNGatewayImpl_h
+#define RF24SNGatewayImpl_h
+
+// Definitions of RF24SNGatewayT, included by RF24SNGateway.h
+
+#define RF24SN_GATEWAY_TEMPLATE template<uint16_t MaxClients, uint8_t MaxClientTopics, uint8_t TopicLen, uint16_t MaxTopics, uint16_t MaxQueuedValues, \
+	uint16_t ClientBuckets, uint16_t TopicBuckets, uint8_t MaxClientQueue, uint16_t MaxFilterNodes>
+#define RF24SN_GATEWAY_T RF24SNGatewayT<MaxClients, MaxClientTopics, TopicLen, MaxTopics, MaxQueuedValues, \
+	ClientBuckets, TopicBuckets, MaxClientQueue, MaxFilterNodes>
+
+RF24SN_GATEWAY_TEMPLATE
+RF24SN_GATEWAY_T::RF24SNGatewayT(RF24* radio, RF24Network* network, RF24SNConfig* config, messageHandler onMessageHandler, subsribeHandler onSubsribeHandler):RF24SNGatewayBase(radio, network, config, onMessageHandler, onSubsribeHandler){
+	for(uint16_t bucket = 0 ; bucket < TopicBuckets; bucket++){
+		topicBuckets[bucket] = TOPIC_NOT_FOUND_IDX;
+	}
+	freeTopic = TOPIC_NOT_FOUND_IDX;
+	freeQueuedValue = QUEUE_NONE;
+	for(QueueIndex value = MaxQueuedValues ; value > 0; value--){
+		queuedValues[value - 1].next = freeQueuedValue;
+		freeQueuedValue = value - 1;
+	}
+	_nextTxClient = CLIENT_NOT_FOUND_IDX;
+	_readyClients = 0;
+	_probeHandle = RF24SN_INVALID_HANDLE;
+	filterRoot = FILTER_NODE_NONE;
+	freeFilterNode = FILTER_NODE_NONE;
+	for(FilterNodeIndex node = MaxFilterNodes ; node > 0; node--){
+		filterNodes[node - 1].nextSibling = freeFilterNode;
+		freeFilterNode = node - 1;
+	}
+	for(TopicIndex topicIndex = MaxTopics ; topicIndex > 0; topicIndex--){
+		topicTable[topicIndex - 1].nextInBucket = freeTopic;
+		freeTopic = topicIndex - 1;
+	}
+	for(uint16_t bucket = 0 ; bucket < ClientBuckets; bucket++){
+		clientBuckets[bucket] = CLIENT_NOT_FOUND_IDX;
+	}
+	oldestClient = CLIENT_NOT_FOUND_IDX;
+	newestClient = CLIENT_NOT_FOUND_IDX;
+	freeClient = CLIENT_NOT_FOUND_IDX;
+#ifdef RF24SN_HAS_INGRESS
+	_ingressPosted = 0;
+	_ingressOverflows = 0;
+	_ingressCoalesced = 0;
+#endif
+	for(ClientIndex clientIndex = MaxClients ; clientIndex > 0; clientIndex--){
+		clients[clientIndex - 1].prevActive = freeClient;
+		freeClient = clientIndex - 1;
+	}
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::update(void){
+	RF24SN::update();
+#ifdef RF24SN_HAS_INGRESS
+	RF24SNGatewayT::takePostedValues();
+#endif
+	RF24SNGatewayT::scheduleTx();
+	RF24SNGatewayT::checkInactiveClients();
+}
+
+RF24SN_GATEWAY_TEMPLATE
+uint32_t RF24SN_GATEWAY_T::getUpdateTimeout(void){
+	uint32_t timeout = RF24SN::getUpdateTimeout();
+	uint32_t checkTimeout = RF24SN::timeLeft(lastInactiveCheck, RF24SN_CLIENT_INACTIVE_DELAY);
+	timeout = checkTimeout < timeout ? checkTimeout : timeout;
+	// With the request table full nothing is sent before a request completes or times out,
+	// RF24SN::getUpdateTimeout() covers the timeouts and an ack wakes the loop like any frame
+	if(RF24SN::freeRequests() == 0){
+		return timeout;
+	}
+	ClientIndex clientIndex = _nextTxClient;
+	for(ClientIndex visited = 0 ; visited < _readyClients && timeout > 0; visited++){
+		const Client& client = clients[clientIndex];
+		clientIndex = client.nextReady;
+		if(client.away || client.probing || client.inFlight >= RF24SN_CLIENT_MAX_IN_FLIGHT
+			|| !RF24SNGatewayT::isListening(client)){
+			continue;
+		}
+		// Same conditions as scheduleTx(), a value is sent once the client listens and has a token
+		uint32_t txTimeout = RF24SN::timeLeft(client.lastActivity, RF24SN_ACK_DELAY);
+#if RF24SN_CLIENT_TX_RATE > 0
+		if(client.tokens == 0){
+			uint32_t tokenTimeout = RF24SN::timeLeft(client.lastRefill, (1000 + RF24SN_CLIENT_TX_RATE - 1) / RF24SN_CLIENT_TX_RATE);
+			txTimeout = tokenTimeout > txTimeout ? tokenTimeout : txTimeout;
+		}
+#endif
+		timeout = txTimeout < timeout ? txTimeout : timeout;
+	}
+	return timeout;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::checkInactiveClients(void){
+	// Check clients
+	if(RF24SN::hasTimedout(lastInactiveCheck, RF24SN_CLIENT_INACTIVE_DELAY)){
+		IF_RF24SN_DEBUG(
+			Serial.print(F("Chk i/a "));
+			Serial.println(lastInactiveCheck);
+		);
+		lastInactiveCheck = millis();
+		// The activity list is ordered, so only the clients that timed out are visited
+		while(oldestClient != CLIENT_NOT_FOUND_IDX
+			&& RF24SN::hasTimedout(clients[oldestClient].lastActivity, RF24SN_CLIENT_INACTIVE_TIMEOUT)){
+
+			IF_RF24SN_DEBUG(
+				Serial.print(F("Clnt t/o: "));
+				Serial.println(clients[oldestClient].clientId, DEC);
+			);
+			_stats.clientEvictions++;
+			RF24SNGatewayT::resetClient(oldestClient);
+		}
+
+		RF24SNGatewayT::probeClients();
+	}
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::probeClients(void){
+	if(_probeHandle != RF24SN_INVALID_HANDLE || RF24SN::freeRequests() < 2){
+		return;
+	}
+	// Probe the clients that were quiet for a while, those that do not answer are removed
+	ClientIndex clientIndex = oldestClient;
+	while(clientIndex != CLIENT_NOT_FOUND_IDX
+		&& RF24SN::hasTimedout(clients[clientIndex].lastActivity, RF24SN_CLIENT_PROBE_TIMEOUT)){
+
+		// Clients with a duty cycle ping on every wake up, a probe would not reach them
+		if(!clients[clientIndex].probing && clients[clientIndex].sleepInterval == 0){
+			_probeHandle = pingAsync(clients[clientIndex].clientId, NULL);
+			if(_probeHandle != RF24SN_INVALID_HANDLE){
+				IF_RF24SN_DEBUG(
+					Serial.print(F("Clnt prb: "));
+					Serial.println(clients[clientIndex].clientId, DEC);
+				);
+				clients[clientIndex].probing = true;
+			}
+			return;
+		}
+		clientIndex = clients[clientIndex].nextActive;
+	}
+}
+
+RF24SN_GATEWAY_TEMPLATE
+bool RF24SN_GATEWAY_T::isListening(const Client& client){
+	return client.sleepInterval == 0 || !RF24SN::hasTimedout(client.lastActivity, client.wakeWindow);
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::resetClient(ClientIndex clientIndex){
+	IF_RF24SN_DEBUG(
+		Serial.print(F("rst clnt : "));
+		Serial.println(clientIndex, DEC);
+	);
+	if(clients[clientIndex].clientId == RF24SN_CLIENT_EMPTY_ID){
+		return;
+	}
+	for(int topicIndex = 0 ; topicIndex < clients[clientIndex].topicCount; topicIndex++){
+		RF24SNGatewayT::unindexTopic(clientIndex, topicIndex);
+	}
+	while(clients[clientIndex].queueLength > 0){
+		RF24SNGatewayT::dropQueuedValue(clientIndex, true);
+	}
+	clients[clientIndex].away = false;
+	clients[clientIndex].inFlight = 0;
+	clients[clientIndex].deficit = 0;
+	clients[clientIndex].sleepInterval = 0;
+	clients[clientIndex].wakeWindow = 0;
+	RF24SNGatewayT::unindexClient(clientIndex);
+	RF24SNGatewayT::unlinkClient(clientIndex);
+	clients[clientIndex].clientId = RF24SN_CLIENT_EMPTY_ID;
+	clients[clientIndex].topicCount = 0;
+	clients[clientIndex].probing = false;
+	clients[clientIndex].prevActive = freeClient;
+	freeClient = clientIndex;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::resetClients(void){
+	while(oldestClient != CLIENT_NOT_FOUND_IDX){
+		RF24SNGatewayT::resetClient(oldestClient);
+	}
+}
+
+RF24SN_GATEWAY_TEMPLATE
+typename RF24SN_GATEWAY_T::TopicRegistration& RF24SN_GATEWAY_T::topicSlot(TopicSlot slot){
+	return clients[slot / MaxClientTopics].topics[slot % MaxClientTopics];
+}
+
+RF24SN_GATEWAY_TEMPLATE
+typename RF24SN_GATEWAY_T::TopicIndex RF24SN_GATEWAY_T::findTopic(const char* topic, uint16_t topicHash){
+	// Only the topics in the bucket of the topic need to be checked
+	TopicIndex topicIndex = topicBuckets[topicHash & (TopicBuckets - 1)];
+	for( ; topicIndex != TOPIC_NOT_FOUND_IDX; topicIndex = topicTable[topicIndex].nextInBucket){
+		if(topicTable[topicIndex].topicHash == topicHash && strcmp(topicTable[topicIndex].topicName, topic) == 0){
+			break;
+		}
+	}
+	return topicIndex;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+typename RF24SN_GATEWAY_T::TopicIndex RF24SN_GATEWAY_T::createTopic(const char* topic, uint16_t topicHash){
+	TopicIndex topicIndex = freeTopic;
+	if(topicIndex == TOPIC_NOT_FOUND_IDX){
+		IF_RF24SN_DEBUG(Serial.println(F("tpc tbl mx")););
+		return topicIndex;
+	}
+	bool filter = RF24SNGatewayT::isFilter(topic);
+	if(filter && !(RF24SNGatewayT::isValidFilter(topic) && RF24SNGatewayT::insertFilter(topicIndex, topic))){
+		IF_RF24SN_DEBUG(Serial.println(F("fltr inv")););
+		return TOPIC_NOT_FOUND_IDX;
+	}
+	if(!_onSubsribeHandler(topic)){
+		if(filter){
+			RF24SNGatewayT::removeFilter(topicIndex, topic);
+		}
+		return TOPIC_NOT_FOUND_IDX;
+	}
+	freeTopic = topicTable[topicIndex].nextInBucket;
+
+	Topic& entry = topicTable[topicIndex];
+	strcpy(entry.topicName, topic);
+	entry.topicHash = topicHash;
+	entry.refCount = 0;
+	entry.firstSubscriber = TOPIC_SLOT_NONE;
+	entry.hasValue = false;
+	uint16_t bucket = topicHash & (TopicBuckets - 1);
+	entry.nextInBucket = topicBuckets[bucket];
+	topicBuckets[bucket] = topicIndex;
+	return topicIndex;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::releaseTopic(TopicIndex topicIndex){
+	Topic& entry = topicTable[topicIndex];
+	if(--entry.refCount > 0){
+		return;
+	}
+	IF_RF24SN_DEBUG(
+		Serial.print(F("Tpc rel : "));
+		Serial.println(entry.topicName);
+	);
+	if(_onUnsubscribeHandler != NULL){
+		_onUnsubscribeHandler(entry.topicName);
+	}
+	if(RF24SNGatewayT::isFilter(entry.topicName)){
+		RF24SNGatewayT::removeFilter(topicIndex, entry.topicName);
+	}
+	TopicIndex* link = &topicBuckets[entry.topicHash & (TopicBuckets - 1)];
+	while(*link != TOPIC_NOT_FOUND_IDX){
+		if(*link == topicIndex){
+			*link = entry.nextInBucket;
+			break;
+		}
+		link = &topicTable[*link].nextInBucket;
+	}
+	entry.topicName[0] = '\0';
+	entry.nextInBucket = freeTopic;
+	freeTopic = topicIndex;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+typename RF24SN_GATEWAY_T::FilterNodeIndex RF24SN_GATEWAY_T::findFilterNode(const char* filter, bool create){
+	FilterNodeIndex parent = FILTER_NODE_NONE;
+	FilterNodeIndex* children = &filterRoot;
+	const char* level = filter;
+	while(true){
+		uint8_t length;
+		uint16_t levelHash = RF24SNGatewayT::hashLevel(level, length);
+		uint8_t kind = RF24SN_FILTER_LEVEL;
+		if(length == 1 && level[0] == '+'){
+			kind = RF24SN_FILTER_SINGLE;
+		}
+		else if(length == 1 && level[0] == '#'){
+			kind = RF24SN_FILTER_MULTI;
+		}
+
+		FilterNodeIndex node = *children;
+		while(node != FILTER_NODE_NONE
+			&& (filterNodes[node].kind != kind || filterNodes[node].levelHash != levelHash)){
+			node = filterNodes[node].nextSibling;
+		}
+		if(node == FILTER_NODE_NONE){
+			if(!create || freeFilterNode == FILTER_NODE_NONE){
+				// Do not leave the levels added so far behind
+				RF24SNGatewayT::pruneFilterNode(parent);
+				return FILTER_NODE_NONE;
+			}
+			node = freeFilterNode;
+			freeFilterNode = filterNodes[node].nextSibling;
+			filterNodes[node].levelHash = levelHash;
+			filterNodes[node].kind = kind;
+			filterNodes[node].topic = TOPIC_NOT_FOUND_IDX;
+			filterNodes[node].parent = parent;
+			filterNodes[node].firstChild = FILTER_NODE_NONE;
+			filterNodes[node].nextSibling = *children;
+			*children = node;
+		}
+		if(level[length] == '\0'){
+			return node;
+		}
+		level += length + 1;
+		parent = node;
+		children = &filterNodes[node].firstChild;
+	}
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::pruneFilterNode(FilterNodeIndex node){
+	while(node != FILTER_NODE_NONE
+		&& filterNodes[node].topic == TOPIC_NOT_FOUND_IDX
+		&& filterNodes[node].firstChild == FILTER_NODE_NONE){
+
+		FilterNodeIndex parent = filterNodes[node].parent;
+		FilterNodeIndex* link = (parent == FILTER_NODE_NONE) ? &filterRoot : &filterNodes[parent].firstChild;
+		while(*link != node){
+			link = &filterNodes[*link].nextSibling;
+		}
+		*link = filterNodes[node].nextSibling;
+		filterNodes[node].nextSibling = freeFilterNode;
+		freeFilterNode = node;
+		node = parent;
+	}
+}
+
+RF24SN_GATEWAY_TEMPLATE
+bool RF24SN_GATEWAY_T::insertFilter(TopicIndex topicIndex, const char* filter){
+	FilterNodeIndex node = RF24SNGatewayT::findFilterNode(filter, true);
+	if(node == FILTER_NODE_NONE){
+		IF_RF24SN_DEBUG(Serial.println(F("fltr mx")););
+		return false;
+	}
+	// Another filter with the same level hashes, too rare to chain
+	if(filterNodes[node].topic != TOPIC_NOT_FOUND_IDX){
+		return false;
+	}
+	filterNodes[node].topic = topicIndex;
+	return true;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::removeFilter(TopicIndex topicIndex, const char* filter){
+	FilterNodeIndex node = RF24SNGatewayT::findFilterNode(filter, false);
+	if(node != FILTER_NODE_NONE && filterNodes[node].topic == topicIndex){
+		filterNodes[node].topic = TOPIC_NOT_FOUND_IDX;
+		RF24SNGatewayT::pruneFilterNode(node);
+	}
+}
+
+RF24SN_GATEWAY_TEMPLATE
+bool RF24SN_GATEWAY_T::matchFilters(FilterNodeIndex node, const char* level, const char* topic, float value){
+	bool hasClient = false;
+	uint8_t length;
+	uint16_t levelHash = RF24SNGatewayT::hashLevel(level, length);
+	bool lastLevel = (level[length] == '\0');
+	for( ; node != FILTER_NODE_NONE; node = filterNodes[node].nextSibling){
+		FilterNode& filterNode = filterNodes[node];
+		if(filterNode.kind == RF24SN_FILTER_MULTI){
+			hasClient |= RF24SNGatewayT::forwardFilterMatch(filterNode.topic, topic, value);
+		}
+		else if(filterNode.kind == RF24SN_FILTER_SINGLE || filterNode.levelHash == levelHash){
+			if(!lastLevel){
+				hasClient |= RF24SNGatewayT::matchFilters(filterNode.firstChild, level + length + 1, topic, value);
+				continue;
+			}
+			hasClient |= RF24SNGatewayT::forwardFilterMatch(filterNode.topic, topic, value);
+			// 'a/#' also matches 'a'
+			for(FilterNodeIndex child = filterNode.firstChild; child != FILTER_NODE_NONE; child = filterNodes[child].nextSibling){
+				if(filterNodes[child].kind == RF24SN_FILTER_MULTI){
+					hasClient |= RF24SNGatewayT::forwardFilterMatch(filterNodes[child].topic, topic, value);
+				}
+			}
+		}
+	}
+	return hasClient;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+bool RF24SN_GATEWAY_T::forwardFilterMatch(TopicIndex topicIndex, const char* topic, float value){
+	// The trie only compares level hashes
+	if(topicIndex == TOPIC_NOT_FOUND_IDX || !RF24SNGatewayT::matchFilter(topicTable[topicIndex].topicName, topic)){
+		return false;
+	}
+	return RF24SNGatewayT::forwardValue(topicIndex, topic, value);
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::indexTopic(ClientIndex clientIndex, byte topicIndex){
+	TopicRegistration& registration = clients[clientIndex].topics[topicIndex];
+	Topic& entry = topicTable[registration.topic];
+	registration.nextSubscriber = entry.firstSubscriber;
+	entry.firstSubscriber = (TopicSlot)clientIndex * MaxClientTopics + topicIndex;
+	entry.refCount++;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::unindexTopic(ClientIndex clientIndex, byte topicIndex){
+	TopicRegistration& registration = clients[clientIndex].topics[topicIndex];
+	TopicSlot slot = (TopicSlot)clientIndex * MaxClientTopics + topicIndex;
+	TopicSlot* link = &topicTable[registration.topic].firstSubscriber;
+	while(*link != TOPIC_SLOT_NONE){
+		if(*link == slot){
+			*link = registration.nextSubscriber;
+			break;
+		}
+		link = &topicSlot(*link).nextSubscriber;
+	}
+	registration.nextSubscriber = TOPIC_SLOT_NONE;
+	RF24SNGatewayT::releaseTopic(registration.topic);
+	registration.topic = TOPIC_NOT_FOUND_IDX;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+uint16_t RF24SN_GATEWAY_T::clientBucket(uint16_t clientId){
+	return clientId % ClientBuckets;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+typename RF24SN_GATEWAY_T::ClientIndex RF24SN_GATEWAY_T::findClient(uint16_t clientId){
+	// Linear probing, the table always has an empty bucket to stop at
+	uint16_t bucket = RF24SNGatewayT::clientBucket(clientId);
+	while(clientBuckets[bucket] != CLIENT_NOT_FOUND_IDX){
+		if(clients[clientBuckets[bucket]].clientId == clientId){
+			return clientBuckets[bucket];
+		}
+		bucket = (bucket + 1) % ClientBuckets;
+	}
+	return CLIENT_NOT_FOUND_IDX;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::unindexClient(ClientIndex clientIndex){
+	uint16_t hole = RF24SNGatewayT::clientBucket(clients[clientIndex].clientId);
+	while(clientBuckets[hole] != clientIndex){
+		if(clientBuckets[hole] == CLIENT_NOT_FOUND_IDX){
+			return;
+		}
+		hole = (hole + 1) % ClientBuckets;
+	}
+	clientBuckets[hole] = CLIENT_NOT_FOUND_IDX;
+
+	// Shift back the entries after the hole that would no longer be found
+	uint16_t bucket = (hole + 1) % ClientBuckets;
+	while(clientBuckets[bucket] != CLIENT_NOT_FOUND_IDX){
+		uint16_t home = RF24SNGatewayT::clientBucket(clients[clientBuckets[bucket]].clientId);
+		bool homeAfterHole = hole <= bucket ? (home > hole && home <= bucket) : (home > hole || home <= bucket);
+		if(!homeAfterHole){
+			clientBuckets[hole] = clientBuckets[bucket];
+			clientBuckets[bucket] = CLIENT_NOT_FOUND_IDX;
+			hole = bucket;
+		}
+		bucket = (bucket + 1) % ClientBuckets;
+	}
+}
+
+RF24SN_GATEWAY_TEMPLATE
+typename RF24SN_GATEWAY_T::ClientIndex RF24SN_GATEWAY_T::registerClient(uint16_t clientId){
+	IF_RF24SN_DEBUG(Serial.println(F("Clnt reg : ")););
+	ClientIndex clientIndex = freeClient;
+
+	if(clientIndex == CLIENT_NOT_FOUND_IDX){
+		IF_RF24SN_DEBUG(Serial.println(F("Clnt mx")););
+		return clientIndex;
+	}
+
+	freeClient = clients[clientIndex].prevActive;
+	clients[clientIndex].clientId = clientId;
+	clients[clientIndex].prevActive = CLIENT_NOT_FOUND_IDX;
+	clients[clientIndex].nextActive = CLIENT_NOT_FOUND_IDX;
+
+	uint16_t bucket = RF24SNGatewayT::clientBucket(clientId);
+	while(clientBuckets[bucket] != CLIENT_NOT_FOUND_IDX){
+		bucket = (bucket + 1) % ClientBuckets;
+	}
+	clientBuckets[bucket] = clientIndex;
+
+	// Link at the end of the activity list
+	clients[clientIndex].prevActive = newestClient;
+	if(newestClient != CLIENT_NOT_FOUND_IDX){
+		clients[newestClient].nextActive = clientIndex;
+	}
+	else{
+		oldestClient = clientIndex;
+	}
+	newestClient = clientIndex;
+	clients[clientIndex].lastActivity = millis();
+	clients[clientIndex].tokens = RF24SN_CLIENT_TX_BURST;
+	clients[clientIndex].lastRefill = millis();
+	_stats.clientRegistrations++;
+
+	clients[clientIndex].session = nextSession();
+
+	IF_RF24SN_DEBUG(
+		Serial.print(F("Clnt reg : "));
+		Serial.println(clientIndex, DEC);
+	);
+	return clientIndex;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::unlinkClient(ClientIndex clientIndex){
+	Client& client = clients[clientIndex];
+	if(client.prevActive != CLIENT_NOT_FOUND_IDX){
+		clients[client.prevActive].nextActive = client.nextActive;
+	}
+	else{
+		oldestClient = client.nextActive;
+	}
+	if(client.nextActive != CLIENT_NOT_FOUND_IDX){
+		clients[client.nextActive].prevActive = client.prevActive;
+	}
+	else{
+		newestClient = client.prevActive;
+	}
+	client.prevActive = CLIENT_NOT_FOUND_IDX;
+	client.nextActive = CLIENT_NOT_FOUND_IDX;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::touchClient(ClientIndex clientIndex){
+	clients[clientIndex].lastActivity = millis();
+	clients[clientIndex].probing = false;
+	// The client is listening now, send what could not be delivered before
+	clients[clientIndex].away = false;
+	if(clientIndex == newestClient){
+		return;
+	}
+	RF24SNGatewayT::unlinkClient(clientIndex);
+	clients[clientIndex].prevActive = newestClient;
+	if(newestClient != CLIENT_NOT_FOUND_IDX){
+		clients[newestClient].nextActive = clientIndex;
+	}
+	else{
+		oldestClient = clientIndex;
+	}
+	newestClient = clientIndex;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::handleSubscribe(void)
+{
+	// Subscribing upstream might send a blocking request, which reuses the receive buffer
+	RF24NetworkHeader header = _rxHeader;
+	RF24SNSubscribeRequest subscribeRequest;
+	memcpy(&subscribeRequest, _rxBuffer, sizeof(RF24SNSubscribeRequest));
+
+	IF_RF24SN_DEBUG(
+		Serial.print(F("Sbcr "));
+		Serial.print(header.from_node);
+		Serial.print(F(" - "));
+		Serial.println(subscribeRequest.topicName);
+	);
+
+	ClientIndex clientIndex = RF24SNGatewayT::subscribingClient(header.from_node);
+	if(clientIndex == CLIENT_NOT_FOUND_IDX){
+		// The client table is full, repeating the subscribe would not help
+		queueAck(header.from_node, RF24SN_SUBNACK, header.id, NULL, 0);
+		return;
+	}
+
+	// Make sure the topic name is terminated before hashing it
+	subscribeRequest.topicName[RF24SN_TOPIC_LENGTH - 1] = '\0';
+	byte topicId = RF24SNGatewayT::registerTopic(clientIndex, subscribeRequest.topicName);
+	if(topicId == (byte)RF24SN_RSP_FAILED){
+		// Tells the client to stop repeating a subscribe that cannot succeed
+		queueAck(header.from_node, RF24SN_SUBNACK, header.id, NULL, 0);
+		return;
+	}
+
+	// Send back ack
+	RF24SNSubscribeResponse response;
+	response.topicId = topicId;
+	response.session = clients[clientIndex].session;
+	queueAck(header.from_node, RF24SN_SUBACK, header.id, &response, sizeof(RF24SNSubscribeResponse));
+	RF24SNGatewayT::queueLastValue(clientIndex, topicId);
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::handleSubscribeMany(void){
+	// The request was reassembled by RF24Network if it was fragmented
+	// Copied, subscribing upstream might send a blocking request, which reuses the receive buffer
+	RF24NetworkHeader header = _rxHeader;
+	char request[RF24SN_SUBSCRIBE_MANY_SIZE + 1];
+	uint16_t requestLength = _rxLength < RF24SN_SUBSCRIBE_MANY_SIZE ? _rxLength : RF24SN_SUBSCRIBE_MANY_SIZE;
+	memcpy(request, _rxBuffer, requestLength);
+	request[requestLength] = '\0';
+
+	IF_RF24SN_DEBUG(
+		Serial.print(F("Sbcr many "));
+		Serial.println(header.from_node);
+	);
+
+	ClientIndex clientIndex = RF24SNGatewayT::subscribingClient(header.from_node);
+	if(clientIndex == CLIENT_NOT_FOUND_IDX){
+		queueAck(header.from_node, RF24SN_SUBNACK, header.id, NULL, 0);
+		return;
+	}
+
+	// Every name gets an id or a failure, so the client can match them up by position
+	RF24SNSubscribeManyResponse response;
+	uint8_t count = 0;
+	uint16_t offset = 0;
+	while(offset < requestLength && count < RF24SN_MAX_SUBSCRIBE_MANY){
+		char* topicName = request + offset;
+		offset += strlen(topicName) + 1;
+		response.topicIds[count++] = RF24SNGatewayT::registerTopic(clientIndex, topicName);
+	}
+	response.session = clients[clientIndex].session;
+	queueAck(header.from_node, RF24SN_SUBACK, header.id, &response, sizeof(response.session) + count);
+	for(uint8_t idx = 0 ; idx < count; idx++){
+		if(response.topicIds[idx] != (byte)RF24SN_RSP_FAILED){
+			RF24SNGatewayT::queueLastValue(clientIndex, response.topicIds[idx]);
+		}
+	}
+}
+
+RF24SN_GATEWAY_TEMPLATE
+typename RF24SN_GATEWAY_T::ClientIndex RF24SN_GATEWAY_T::subscribingClient(uint16_t clientId){
+	// Try and find existing client
+	ClientIndex clientIndex = RF24SNGatewayT::findClient(clientId);
+
+	IF_RF24SN_DEBUG(
+		Serial.print(F("Clnt fnd: "));
+		Serial.println(clientIndex, DEC);
+	);
+
+	// register new client
+	if(clientIndex == CLIENT_NOT_FOUND_IDX){
+		clientIndex = RF24SNGatewayT::registerClient(clientId);
+
+		// If the client is still not found there is no more space for clients
+		if(clientIndex == CLIENT_NOT_FOUND_IDX){
+			return clientIndex;
+		}
+	}
+
+	// Update the last time we got a request from the client
+	RF24SNGatewayT::touchClient(clientIndex);
+	return clientIndex;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+byte RF24SN_GATEWAY_T::registerTopic(ClientIndex clientIndex, const char* topicName){
+	uint16_t nameLength = strlen(topicName);
+	// An empty name comes from a stray terminator in a bulk subscribe
+	if(nameLength == 0 || nameLength >= TopicLen){
+		IF_RF24SN_DEBUG(Serial.println(F("tpc inv")););
+		return RF24SN_RSP_FAILED;
+	}
+
+	// Index of the topic for the current client
+	int topicIndex = 0;
+
+	// Flag if we have found the topic
+	bool foundTopic = false;
+
+	uint16_t topicHash = RF24SNGatewayT::hashTopic(topicName);
+
+	// Try and find existing topic
+	TopicIndex sharedTopic = RF24SNGatewayT::findTopic(topicName, topicHash);
+	for( ; topicIndex < clients[clientIndex].topicCount; topicIndex++){
+		if(sharedTopic != TOPIC_NOT_FOUND_IDX && clients[clientIndex].topics[topicIndex].topic == sharedTopic){
+			foundTopic = true;
+			break;
+		}
+	}
+	IF_RF24SN_DEBUG(
+		Serial.print(F("tpc fnd: "));
+		Serial.println(foundTopic);
+	);
+	// We already have this topic
+	if(foundTopic){
+		return clients[clientIndex].topics[topicIndex].topicId;
+	}
+	if(clients[clientIndex].topicCount >= MaxClientTopics){
+		IF_RF24SN_DEBUG(Serial.println(F("tpc mx")););
+		return RF24SN_RSP_FAILED;
+	}
+
+	// Only the first client registering for the topic subscribes upstream
+	if(sharedTopic == TOPIC_NOT_FOUND_IDX){
+		sharedTopic = RF24SNGatewayT::createTopic(topicName, topicHash);
+	}
+	if(sharedTopic == TOPIC_NOT_FOUND_IDX){
+		IF_RF24SN_DEBUG(
+			Serial.println(F("Tpc reg f"));
+		);
+		return RF24SN_RSP_FAILED;
+	}
+
+	// Register new topic
+	clients[clientIndex].topicCount = clients[clientIndex].topicCount + 1;
+	clients[clientIndex].topics[topicIndex].topic = sharedTopic;
+	clients[clientIndex].topics[topicIndex].topicId = topicIndex+1;
+	RF24SNGatewayT::indexTopic(clientIndex, topicIndex);
+	IF_RF24SN_DEBUG(
+		Serial.print(F("Tpc reg : "));
+		Serial.println(topicIndex+1, DEC);
+	);
+	return clients[clientIndex].topics[topicIndex].topicId;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::updateClientActivity(uint16_t clientId){
+	// Try and find existing client
+	ClientIndex clientIndex = RF24SNGatewayT::findClient(clientId);
+	if(clientIndex != CLIENT_NOT_FOUND_IDX){
+		RF24SNGatewayT::touchClient(clientIndex);
+	}
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::handlePingRequest(void){
+	RF24SNPingResponse response;
+	response.session = 0;
+	ClientIndex clientIndex = RF24SNGatewayT::findClient(_rxHeader.from_node);
+	if(clientIndex != CLIENT_NOT_FOUND_IDX){
+		response.session = clients[clientIndex].session;
+		// The client woke up, touching it released what was held back for it
+		if(_rxLength >= sizeof(RF24SNPingRequest)){
+			const RF24SNPingRequest& request = *(const RF24SNPingRequest*)_rxBuffer;
+			clients[clientIndex].sleepInterval = request.sleepInterval;
+			clients[clientIndex].wakeWindow = request.wakeWindow;
+		}
+	}
+	queueAck(_rxHeader.from_node, RF24SN_PINGRES, _rxHeader.id, &response, sizeof(RF24SNPingResponse));
+}
+
+RF24SN_GATEWAY_TEMPLATE
+bool RF24SN_GATEWAY_T::handleMessage(bool swallowInvalid){
+	updateClientActivity(_rxHeader.from_node);
+	return RF24SN::handleMessage(swallowInvalid);
+}
+
+// Only the message types the gateway adds, the rest falls through to the table of RF24SN
+RF24SN_GATEWAY_TEMPLATE
+const RF24SN::frameHandler RF24SN_GATEWAY_T::gatewayFrameHandlers[RF24SN_MSG_TYPES] RF24SN_TABLE_ATTR = {
+	NULL, NULL, NULL, NULL, NULL, NULL,
+	static_cast<RF24SN::frameHandler>(&RF24SNGatewayT::handleSubscribe), // RF24SN_SUBSCRIBE
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL,
+	static_cast<RF24SN::frameHandler>(&RF24SNGatewayT::handleSubscribeMany), // RF24SN_SUBSCRIBE_MANY
+	NULL
+};
+
+RF24SN_GATEWAY_TEMPLATE
+RF24SN::frameHandler RF24SN_GATEWAY_T::getFrameHandler(uint8_t messageType){
+	frameHandler handler = NULL;
+	if(messageType >= RF24SN_FIRST_MSG_TYPE && messageType < RF24SN_FIRST_MSG_TYPE + RF24SN_MSG_TYPES){
+		RF24SN_READ_TABLE(handler, gatewayFrameHandlers[messageType - RF24SN_FIRST_MSG_TYPE]);
+	}
+	if(handler == NULL){
+		handler = RF24SN::getFrameHandler(messageType);
+	}
+	return handler;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+bool RF24SN_GATEWAY_T::checkSubscription(const char* topic, float value){
+	IF_RF24SN_DEBUG(
+		Serial.print(F("chk sbr "));
+		Serial.println(topic);
+	);
+	return RF24SNGatewayT::publishValue(RF24SNGatewayT::findTopic(topic, RF24SNGatewayT::hashTopic(topic)), topic, value);
+}
+
+RF24SN_GATEWAY_TEMPLATE
+bool RF24SN_GATEWAY_T::publishValue(TopicIndex topicIndex, const char* topic, float value){
+	bool hasClient = false;
+	if(topicIndex != TOPIC_NOT_FOUND_IDX){
+		topicTable[topicIndex].lastValue = value;
+		topicTable[topicIndex].hasValue = true;
+		hasClient = RF24SNGatewayT::forwardValue(topicIndex, NULL, value);
+	}
+	// The topic name is sent along with a filter match, so it must fit in a topic packet
+	if(filterRoot != FILTER_NODE_NONE && strlen(topic) < RF24SN_TOPIC_LENGTH){
+		hasClient |= RF24SNGatewayT::matchFilters(filterRoot, topic, topic, value);
+	}
+	return hasClient;
+}
+
+#ifdef RF24SN_HAS_INGRESS
+RF24SN_GATEWAY_TEMPLATE
+bool RF24SN_GATEWAY_T::postSubscription(const char* topic, float value){
+	PostedValue posted;
+	if(strlen(topic) >= sizeof(posted.topic)){
+		return false;
+	}
+	strcpy(posted.topic, topic);
+	posted.value = value;
+	if(!_ingress.push(posted)){
+		_ingressOverflows++;
+		return false;
+	}
+	_ingressPosted++;
+	if(_idle != NULL){
+		_idle->wake();
+	}
+	return true;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+RF24SNIngressStats RF24SN_GATEWAY_T::getIngressStats(void){
+	RF24SNIngressStats stats;
+	stats.posted = _ingressPosted;
+	stats.overflows = _ingressOverflows;
+	stats.coalesced = _ingressCoalesced;
+	return stats;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::takePostedValues(void){
+	PostedValue posted;
+	TopicIndex firstPosted = TOPIC_NOT_FOUND_IDX;
+	TopicIndex lastPosted = TOPIC_NOT_FOUND_IDX;
+	// Only what is queued now, the broker thread may keep posting
+	for(uint32_t taken = 0 ; taken < RF24SN_INGRESS_QUEUE_SIZE && _ingress.pop(posted); taken++){
+		TopicIndex topicIndex = RF24SNGatewayT::findTopic(posted.topic, RF24SNGatewayT::hashTopic(posted.topic));
+		if(topicIndex == TOPIC_NOT_FOUND_IDX){
+			// Only filters can match, the queues of the clients keep the newest value of the topic
+			RF24SNGatewayT::publishValue(TOPIC_NOT_FOUND_IDX, posted.topic, posted.value);
+			continue;
+		}
+		// The topics keep the newest value and their order in a list through the topic table
+		Topic& entry = topicTable[topicIndex];
+		if(entry.posted){
+			_ingressCoalesced++;
+		}
+		else{
+			entry.posted = true;
+			entry.nextPosted = TOPIC_NOT_FOUND_IDX;
+			if(lastPosted == TOPIC_NOT_FOUND_IDX){
+				firstPosted = topicIndex;
+			}
+			else{
+				topicTable[lastPosted].nextPosted = topicIndex;
+			}
+			lastPosted = topicIndex;
+		}
+		entry.postedValue = posted.value;
+	}
+	while(firstPosted != TOPIC_NOT_FOUND_IDX){
+		TopicIndex topicIndex = firstPosted;
+		Topic& entry = topicTable[topicIndex];
+		firstPosted = entry.nextPosted;
+		entry.posted = false;
+		RF24SNGatewayT::publishValue(topicIndex, entry.topicName, entry.postedValue);
+	}
+}
+#endif
+
+RF24SN_GATEWAY_TEMPLATE
+bool RF24SN_GATEWAY_T::forwardValue(TopicIndex topicIndex, const char* topic, float value){
+	bool hasClient = false;
+
+	// Only the clients registered for the topic are visited
+	TopicSlot slot = topicTable[topicIndex].firstSubscriber;
+	for( ; slot != TOPIC_SLOT_NONE; slot = topicSlot(slot).nextSubscriber){
+		TopicRegistration& registration = topicSlot(slot);
+		ClientIndex clientIndex = slot / MaxClientTopics;
+		IF_RF24SN_DEBUG(
+			Serial.print(F("fwd sbr "));
+			Serial.print(clients[clientIndex].clientId, DEC);
+			Serial.print(F(" tpc "));
+			Serial.println(registration.topicId, DEC);
+		);
+		if(topic == NULL){
+			RF24SNPacket requestPacket{registration.topicId, value};
+			RF24SNGatewayT::queueValue(clientIndex, RF24SN_PUBLISH, &requestPacket, sizeof(RF24SNPacket), false);
+		}
+		else{
+			RF24SNTopicPacket requestPacket;
+			requestPacket.topicId = registration.topicId;
+			requestPacket.value = value;
+			uint8_t nameLength = strlen(topic);
+			memcpy(requestPacket.topicName, topic, nameLength);
+			RF24SNGatewayT::queueValue(clientIndex, RF24SN_PUBLISH_TOPIC, &requestPacket, sizeof(RF24SNTopicPacket) - sizeof(requestPacket.topicName) + nameLength, false);
+		}
+		hasClient = true;
+	}
+	return hasClient;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::queueValue(ClientIndex clientIndex, uint8_t messageType, const void* payload, uint8_t payloadLength, bool requeue){
+	Client& client = clients[clientIndex];
+	// Values of the same topic differ only in the value, a topic packet also carries the name
+	const uint8_t* bytes = (const uint8_t*)payload;
+	for(QueueIndex valueIndex = client.queueHead ; valueIndex != QUEUE_NONE; valueIndex = queuedValues[valueIndex].next){
+		QueuedValue& queued = queuedValues[valueIndex];
+		if(queued.messageType == messageType && queued.payloadLength == payloadLength && queued.payload[0] == bytes[0]
+			&& memcmp(queued.payload + sizeof(RF24SNPacket), bytes + sizeof(RF24SNPacket), payloadLength - sizeof(RF24SNPacket)) == 0){
+			// A requeued value is older than the one waiting
+			if(!requeue){
+				memcpy(queued.payload, payload, payloadLength);
+			}
+			IF_RF24SN_DEBUG(
+				Serial.print(F("q rplc "));
+				Serial.println(client.clientId, DEC);
+			);
+			return;
+		}
+	}
+	if(client.queueLength >= MaxClientQueue || freeQueuedValue == QUEUE_NONE){
+		// A requeued value is older than all values in the queue
+		bool dropOldest = (_queuePolicy == RF24SN_QUEUE_DROP_OLDEST);
+		if(client.queueLength == 0 || dropOldest == requeue){
+			IF_RF24SN_DEBUG(
+				Serial.print(F("q drop "));
+				Serial.println(client.clientId, DEC);
+			);
+			if(_onDeliveryHandler != NULL){
+				_onDeliveryHandler(client.clientId, ((const uint8_t*)payload)[0], false);
+			}
+			return;
+		}
+		RF24SNGatewayT::dropQueuedValue(clientIndex, dropOldest);
+	}
+
+	QueueIndex valueIndex = freeQueuedValue;
+	QueuedValue& queued = queuedValues[valueIndex];
+	freeQueuedValue = queued.next;
+	queued.messageType = messageType;
+	memcpy(queued.payload, payload, payloadLength);
+	queued.payloadLength = payloadLength;
+	queued.next = QUEUE_NONE;
+	if(client.queueHead == QUEUE_NONE){
+		client.queueHead = valueIndex;
+		client.queueTail = valueIndex;
+		RF24SNGatewayT::linkReady(clientIndex);
+	}
+	else if(requeue){
+		queued.next = client.queueHead;
+		client.queueHead = valueIndex;
+	}
+	else{
+		queuedValues[client.queueTail].next = valueIndex;
+		client.queueTail = valueIndex;
+	}
+	client.queueLength++;
+	IF_RF24SN_DEBUG(
+		Serial.print(F("q add "));
+		Serial.println(client.clientId, DEC);
+	);
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::queueLastValue(ClientIndex clientIndex, byte topicId){
+	const Topic& topic = topicTable[clients[clientIndex].topics[topicId - 1].topic];
+	if(topic.hasValue){
+		RF24SNPacket requestPacket{topicId, topic.lastValue};
+		RF24SNGatewayT::queueValue(clientIndex, RF24SN_PUBLISH, &requestPacket, sizeof(RF24SNPacket), false);
+	}
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::dropQueuedValue(ClientIndex clientIndex, bool oldest){
+	Client& client = clients[clientIndex];
+	QueueIndex valueIndex = client.queueHead;
+	if(oldest || client.queueLength == 1){
+		client.queueHead = queuedValues[valueIndex].next;
+		if(client.queueHead == QUEUE_NONE){
+			client.queueTail = QUEUE_NONE;
+			RF24SNGatewayT::unlinkReady(clientIndex);
+		}
+	}
+	else{
+		// Only linked forward, the queues are short
+		while(queuedValues[valueIndex].next != client.queueTail){
+			valueIndex = queuedValues[valueIndex].next;
+		}
+		queuedValues[valueIndex].next = QUEUE_NONE;
+		QueueIndex newTail = valueIndex;
+		valueIndex = client.queueTail;
+		client.queueTail = newTail;
+	}
+	client.queueLength--;
+	if(_onDeliveryHandler != NULL){
+		_onDeliveryHandler(client.clientId, queuedValues[valueIndex].payload[0], false);
+	}
+	queuedValues[valueIndex].next = freeQueuedValue;
+	freeQueuedValue = valueIndex;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::linkReady(ClientIndex clientIndex){
+	Client& client = clients[clientIndex];
+	if(_nextTxClient == CLIENT_NOT_FOUND_IDX){
+		client.prevReady = clientIndex;
+		client.nextReady = clientIndex;
+		_nextTxClient = clientIndex;
+	}
+	else{
+		// Just before the client the next round starts with, the end of the ring
+		client.nextReady = _nextTxClient;
+		client.prevReady = clients[_nextTxClient].prevReady;
+		clients[client.prevReady].nextReady = clientIndex;
+		clients[_nextTxClient].prevReady = clientIndex;
+	}
+	_readyClients++;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::unlinkReady(ClientIndex clientIndex){
+	Client& client = clients[clientIndex];
+	_readyClients--;
+	if(_readyClients == 0){
+		_nextTxClient = CLIENT_NOT_FOUND_IDX;
+	}
+	else{
+		clients[client.prevReady].nextReady = client.nextReady;
+		clients[client.nextReady].prevReady = client.prevReady;
+		if(_nextTxClient == clientIndex){
+			_nextTxClient = client.nextReady;
+		}
+	}
+	client.prevReady = CLIENT_NOT_FOUND_IDX;
+	client.nextReady = CLIENT_NOT_FOUND_IDX;
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::scheduleTx(void){
+	// The clients keep their turn and their deficit until a request slot is free
+	if(RF24SN::freeRequests() == 0){
+		return;
+	}
+	uint8_t budget = RF24SN_TX_FRAMES_PER_UPDATE;
+	// Stop once every client with queued values had a turn without sending
+	ClientIndex idleClients = 0;
+	ClientIndex clientIndex = _nextTxClient;
+	while(budget > 0 && clientIndex != CLIENT_NOT_FOUND_IDX && idleClients < _readyClients){
+		Client& client = clients[clientIndex];
+		ClientIndex nextIndex = client.nextReady;
+		bool sent = false;
+		// Give the client the time to start listening after it was active, like an ack
+		// A client that is probed did not answer for a while, its values wait for the answer
+		if(!client.away && !client.probing
+			&& RF24SN::hasTimedout(client.lastActivity, RF24SN_ACK_DELAY) && RF24SNGatewayT::isListening(client)){
+
+			RF24SNGatewayT::refillTokens(client);
+			client.deficit += RF24SN_TX_QUANTUM;
+			while(client.queueHead != QUEUE_NONE && budget > 0
+				&& client.inFlight < RF24SN_CLIENT_MAX_IN_FLIGHT
+				&& (RF24SN_CLIENT_TX_RATE == 0 || client.tokens > 0)){
+
+				QueueIndex valueIndex = client.queueHead;
+				QueuedValue& queued = queuedValues[valueIndex];
+				uint16_t cost = queued.payloadLength + sizeof(RF24NetworkHeader);
+				if(cost > client.deficit){
+					break;
+				}
+				if(sendRequestAsync(client.clientId, queued.messageType, queued.payload, queued.payloadLength, 3, NULL) == RF24SN_INVALID_HANDLE){
+					// The request table is full for every client
+					budget = 0;
+					break;
+				}
+				client.deficit -= cost;
+				client.inFlight++;
+				if(client.tokens > 0){
+					client.tokens--;
+				}
+				budget--;
+				sent = true;
+
+				client.queueHead = queued.next;
+				client.queueLength--;
+				queued.next = freeQueuedValue;
+				freeQueuedValue = valueIndex;
+			}
+		}
+		if(client.queueHead == QUEUE_NONE){
+			client.queueTail = QUEUE_NONE;
+			RF24SNGatewayT::unlinkReady(clientIndex);
+			if(_readyClients == 0){
+				nextIndex = CLIENT_NOT_FOUND_IDX;
+			}
+		}
+		// Only a client that is held back by its deficit keeps it for the next round
+		if(client.queueHead == QUEUE_NONE || client.away || client.probing || !RF24SNGatewayT::isListening(client)
+			|| client.inFlight >= RF24SN_CLIENT_MAX_IN_FLIGHT
+			|| (RF24SN_CLIENT_TX_RATE != 0 && client.tokens == 0)){
+			client.deficit = 0;
+		}
+		idleClients = sent ? 0 : idleClients + 1;
+		clientIndex = nextIndex;
+	}
+	if(clientIndex != CLIENT_NOT_FOUND_IDX){
+		_nextTxClient = clientIndex;
+	}
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::refillTokens(Client& client){
+#if RF24SN_CLIENT_TX_RATE > 0
+	uint32_t elapsed = millis() - client.lastRefill;
+	// A client that was quiet long enough gets a full bucket
+	if(elapsed >= (uint32_t)RF24SN_CLIENT_TX_BURST * 1000 / RF24SN_CLIENT_TX_RATE){
+		client.tokens = RF24SN_CLIENT_TX_BURST;
+		client.lastRefill = millis();
+		return;
+	}
+	uint32_t due = elapsed * RF24SN_CLIENT_TX_RATE / 1000;
+	if(due > 0){
+		client.tokens = (client.tokens + due > RF24SN_CLIENT_TX_BURST) ? RF24SN_CLIENT_TX_BURST : client.tokens + due;
+		client.lastRefill += due * 1000 / RF24SN_CLIENT_TX_RATE;
+	}
+#else
+	(void)client;
+#endif
+}
+
+RF24SN_GATEWAY_TEMPLATE
+void RF24SN_GATEWAY_T::onRequestComplete(const RF24SNRequest& request, bool success, const void* response, uint16_t responseLength){
+	if(request.messageType == RF24SN_PUBLISH || request.messageType == RF24SN_PUBLISH_TOPIC){
+		ClientIndex clientIndex = RF24SNGatewayT::findClient(request.nodeId);
+		if(clientIndex != CLIENT_NOT_FOUND_IDX && clients[clientIndex].inFlight > 0){
+			clients[clientIndex].inFlight--;
+		}
+		if(!success && clientIndex != CLIENT_NOT_FOUND_IDX){
+			// Kept until the client shows activity, reported when it is dropped
+			clients[clientIndex].away = true;
+			RF24SNGatewayT::queueValue(clientIndex, request.messageType, request.payload, request.payloadLength, true);
+		}
+		else if(_onDeliveryHandler != NULL){
+			_onDeliveryHandler(request.nodeId, request.payload[0], success);
+		}
+	}
+	else if(request.messageType == RF24SN_PINGREQ && request.handle == _probeHandle){
+		_probeHandle = RF24SN_INVALID_HANDLE;
+		ClientIndex clientIndex = RF24SNGatewayT::findClient(request.nodeId);
+		if(!success && clientIndex != CLIENT_NOT_FOUND_IDX && clients[clientIndex].probing){
+			IF_RF24SN_DEBUG(
+				Serial.print(F("Clnt dead: "));
+				Serial.println(request.nodeId, DEC);
+			);
+			_stats.clientEvictions++;
+			RF24SNGatewayT::resetClient(clientIndex);
+		}
+		// The next quiet client does not wait for the next check
+		RF24SNGatewayT::probeClients();
+	}
+	RF24SN::onRequestComplete(request, success, response, responseLength);
+}
+
+#undef RF24SN_GATEWAY_TEMPLATE
+#undef RF24SN_GATEWAY_T
+
+#endif
@@ -0,0 +1,308 @@
+#include "RF24SNMultiGateway.h"
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+thread_local RF24SNMultiGateway* RF24SNMultiGateway::_currentGateway = NULL;
+thread_local uint8_t RF24SNMultiGateway::_currentRadio = 0;
+
+RF24SNMultiGateway::RF24SNMultiGateway(radioMessageHandler onMessageHandler, subsribeHandler onSubsribeHandler){
+	_onMessageHandler = onMessageHandler;
+	_onSubsribeHandler = onSubsribeHandler;
+	_onUnsubscribeHandler = NULL;
+	_radioCount = 0;
+	_running = false;
+	_radioQueueDrops = 0;
+	_brokerQueueDrops = 0;
+	for(uint16_t bucket = 0 ; bucket < RF24SN_SHARED_TOPIC_BUCKETS; bucket++){
+		_topicBuckets[bucket] = RF24SN_SHARED_TOPIC_NONE;
+	}
+	for(uint16_t topicIndex = 0 ; topicIndex < RF24SN_MAX_SHARED_TOPICS; topicIndex++){
+		_topics[topicIndex].next = topicIndex + 1 < RF24SN_MAX_SHARED_TOPICS ? topicIndex + 1 : RF24SN_SHARED_TOPIC_NONE;
+	}
+	_freeTopic = 0;
+	_filters = RF24SN_SHARED_TOPIC_NONE;
+	_pendingHead = RF24SN_SHARED_TOPIC_NONE;
+	_pendingTail = RF24SN_SHARED_TOPIC_NONE;
+}
+
+RF24SNMultiGateway::~RF24SNMultiGateway(){
+	RF24SNMultiGateway::end();
+	for(uint8_t radio = 0 ; radio < _radioCount; radio++){
+		delete _radios[radio].gateway;
+	}
+}
+
+int8_t RF24SNMultiGateway::addRadio(RF24* radio, RF24Network* network, RF24SNConfig* config, int irqFd){
+	if(_radioCount >= RF24SN_MAX_RADIOS || _running){
+		return -1;
+	}
+	RF24SNGateway* gateway = new RF24SNGateway(radio, network, config, onRadioMessage, onRadioSubscribe);
+	gateway->setUnsubscribeHandler(onRadioUnsubscribe);
+	_radios[_radioCount].gateway = gateway;
+	_radios[_radioCount].irqFd = irqFd;
+	return _radioCount++;
+}
+
+RF24SNGateway& RF24SNMultiGateway::getGateway(uint8_t radio){
+	return *_radios[radio].gateway;
+}
+
+void RF24SNMultiGateway::setUnsubscribeHandler(unsubscribeHandler onUnsubscribeHandler){
+	_onUnsubscribeHandler = onUnsubscribeHandler;
+}
+
+bool RF24SNMultiGateway::begin(void){
+	if(_running){
+		return true;
+	}
+	// The radios are set up one after the other, they may share the SPI bus
+	for(uint8_t radio = 0 ; radio < _radioCount; radio++){
+		_radios[radio].gateway->begin();
+		if(!_radios[radio].loop.begin(_radios[radio].irqFd)){
+			return false;
+		}
+		_radios[radio].gateway->setIdle(&_radios[radio].loop);
+	}
+	_running = true;
+	for(uint8_t radio = 0 ; radio < _radioCount; radio++){
+		_radios[radio].thread = std::thread(&RF24SNMultiGateway::runRadio, this, radio);
+	}
+	return true;
+}
+
+void RF24SNMultiGateway::end(void){
+	_running = false;
+	for(uint8_t radio = 0 ; radio < _radioCount; radio++){
+		_radios[radio].loop.wake();
+		if(_radios[radio].thread.joinable()){
+			_radios[radio].thread.join();
+		}
+	}
+}
+
+void RF24SNMultiGateway::runRadio(uint8_t radio){
+	_currentGateway = this;
+	_currentRadio = radio;
+	Radio& self = _radios[radio];
+	while(_running.load(std::memory_order_relaxed)){
+		self.gateway->update();
+		self.loop.wait(self.gateway->getUpdateTimeout());
+	}
+}
+
+void RF24SNMultiGateway::update(void){
+	// The handlers run without the lock, the radio threads keep registering meanwhile
+	char topicName[RF24SN_TOPIC_LENGTH];
+	std::unique_lock<std::mutex> lock(_topicsMutex);
+	while(_pendingHead != RF24SN_SHARED_TOPIC_NONE){
+		RF24SNSharedTopicIndex topicIndex = _pendingHead;
+		RF24SNSharedTopic& shared = _topics[topicIndex];
+		_pendingHead = shared.nextPending;
+		if(_pendingHead == RF24SN_SHARED_TOPIC_NONE){
+			_pendingTail = RF24SN_SHARED_TOPIC_NONE;
+		}
+		shared.pending = false;
+
+		// Only the latest state counts, a topic left and registered again meanwhile stays subscribed
+		bool subscribe = shared.radios != 0 && !shared.refused;
+		if(subscribe == shared.upstream){
+			releaseTopic(topicIndex);
+			continue;
+		}
+		shared.upstream = subscribe;
+		strcpy(topicName, shared.topicName);
+		lock.unlock();
+		if(subscribe){
+			subscribe = _onSubsribeHandler(topicName);
+		}
+		else if(_onUnsubscribeHandler != NULL){
+			_onUnsubscribeHandler(topicName);
+		}
+		lock.lock();
+		if(shared.upstream && !subscribe){
+			shared.upstream = false;
+			shared.refused = true;
+		}
+		releaseTopic(topicIndex);
+	}
+	lock.unlock();
+
+	RF24SNBrokerMessage queued;
+	for(uint8_t radio = 0 ; radio < _radioCount; radio++){
+		while(_radios[radio].messages.pop(queued)){
+			if(queued.message.topicName != NULL){
+				queued.message.topicName = queued.topicName;
+			}
+			_onMessageHandler(radio, queued.message);
+		}
+	}
+}
+
+bool RF24SNMultiGateway::checkSubscription(const char* topic, float value){
+	// Longer names can not be registered, nor sent along with a filter match
+	if(strlen(topic) >= RF24SN_TOPIC_LENGTH){
+		return false;
+	}
+	uint16_t topicHash = RF24SNGateway::hashTopic(topic);
+	uint8_t radios = 0;
+	{
+		std::lock_guard<std::mutex> lock(_topicsMutex);
+		RF24SNSharedTopicIndex topicIndex = findTopic(topic, topicHash);
+		if(topicIndex != RF24SN_SHARED_TOPIC_NONE && !_topics[topicIndex].refused){
+			radios = _topics[topicIndex].radios;
+		}
+		for(topicIndex = _filters ; topicIndex != RF24SN_SHARED_TOPIC_NONE; topicIndex = _topics[topicIndex].next){
+			RF24SNSharedTopic& shared = _topics[topicIndex];
+			if(!shared.refused && RF24SNGateway::matchFilter(shared.topicName, topic)){
+				radios |= shared.radios;
+			}
+		}
+	}
+
+	// Only the radios with a matching registration are woken up
+	for(uint8_t radio = 0 ; radio < _radioCount; radio++){
+		if((radios & (1 << radio)) && !_radios[radio].gateway->postSubscription(topic, value)){
+			_radioQueueDrops++;
+		}
+	}
+	return radios != 0;
+}
+
+RF24SNMultiGatewayStats RF24SNMultiGateway::getStats(void){
+	RF24SNMultiGatewayStats stats;
+	stats.radioQueueDrops = _radioQueueDrops;
+	stats.brokerQueueDrops = _brokerQueueDrops;
+	return stats;
+}
+
+RF24SNSharedTopicIndex RF24SNMultiGateway::findTopic(const char* topic, uint16_t topicHash){
+	RF24SNSharedTopicIndex topicIndex;
+	if(RF24SNGateway::isFilter(topic)){
+		topicIndex = _filters;
+	}
+	else{
+		topicIndex = _topicBuckets[topicHash & (RF24SN_SHARED_TOPIC_BUCKETS - 1)];
+	}
+	for( ; topicIndex != RF24SN_SHARED_TOPIC_NONE; topicIndex = _topics[topicIndex].next){
+		if(_topics[topicIndex].topicHash == topicHash && strcmp(_topics[topicIndex].topicName, topic) == 0){
+			return topicIndex;
+		}
+	}
+	return RF24SN_SHARED_TOPIC_NONE;
+}
+
+RF24SNSharedTopicIndex RF24SNMultiGateway::createTopic(const char* topic, uint16_t topicHash){
+	RF24SNSharedTopicIndex topicIndex = _freeTopic;
+	if(topicIndex == RF24SN_SHARED_TOPIC_NONE){
+		return RF24SN_SHARED_TOPIC_NONE;
+	}
+	RF24SNSharedTopic& shared = _topics[topicIndex];
+	_freeTopic = shared.next;
+	strcpy(shared.topicName, topic);
+	shared.topicHash = topicHash;
+	shared.radios = 0;
+	shared.upstream = false;
+	shared.refused = false;
+	shared.pending = false;
+	RF24SNSharedTopicIndex* head = RF24SNGateway::isFilter(topic) ? &_filters : &_topicBuckets[topicHash & (RF24SN_SHARED_TOPIC_BUCKETS - 1)];
+	shared.next = *head;
+	*head = topicIndex;
+	return topicIndex;
+}
+
+void RF24SNMultiGateway::releaseTopic(RF24SNSharedTopicIndex topicIndex){
+	RF24SNSharedTopic& shared = _topics[topicIndex];
+	if(shared.radios != 0 || shared.upstream || shared.pending){
+		return;
+	}
+	RF24SNSharedTopicIndex* link = RF24SNGateway::isFilter(shared.topicName) ? &_filters : &_topicBuckets[shared.topicHash & (RF24SN_SHARED_TOPIC_BUCKETS - 1)];
+	while(*link != topicIndex){
+		link = &_topics[*link].next;
+	}
+	*link = shared.next;
+	shared.next = _freeTopic;
+	_freeTopic = topicIndex;
+}
+
+void RF24SNMultiGateway::queuePending(RF24SNSharedTopicIndex topicIndex){
+	RF24SNSharedTopic& shared = _topics[topicIndex];
+	if(shared.pending){
+		return;
+	}
+	shared.pending = true;
+	shared.nextPending = RF24SN_SHARED_TOPIC_NONE;
+	if(_pendingTail == RF24SN_SHARED_TOPIC_NONE){
+		_pendingHead = topicIndex;
+	}
+	else{
+		_topics[_pendingTail].nextPending = topicIndex;
+	}
+	_pendingTail = topicIndex;
+}
+
+void RF24SNMultiGateway::onRadioMessage(RF24SNMessage& message){
+	RF24SNMultiGateway* self = _currentGateway;
+	if(self == NULL){
+		return;
+	}
+	RF24SNBrokerMessage queued;
+	queued.message = message;
+	if(message.topicName != NULL){
+		strncpy(queued.topicName, message.topicName, RF24SN_TOPIC_LENGTH - 1);
+		queued.topicName[RF24SN_TOPIC_LENGTH - 1] = '\0';
+	}
+	if(!self->_radios[_currentRadio].messages.push(queued)){
+		self->_brokerQueueDrops++;
+	}
+}
+
+bool RF24SNMultiGateway::onRadioSubscribe(const char* topic){
+	RF24SNMultiGateway* self = _currentGateway;
+	if(self == NULL){
+		return false;
+	}
+	uint16_t topicHash = RF24SNGateway::hashTopic(topic);
+	std::lock_guard<std::mutex> lock(self->_topicsMutex);
+	RF24SNSharedTopicIndex topicIndex = self->findTopic(topic, topicHash);
+	if(topicIndex == RF24SN_SHARED_TOPIC_NONE){
+		topicIndex = self->createTopic(topic, topicHash);
+		if(topicIndex == RF24SN_SHARED_TOPIC_NONE){
+			return false;
+		}
+	}
+	RF24SNSharedTopic& shared = self->_topics[topicIndex];
+	if(shared.refused){
+		return false;
+	}
+	// The broker subscribes the topic on its next update()
+	if(!shared.upstream){
+		self->queuePending(topicIndex);
+	}
+	shared.radios |= 1 << _currentRadio;
+	return true;
+}
+
+void RF24SNMultiGateway::onRadioUnsubscribe(const char* topic){
+	RF24SNMultiGateway* self = _currentGateway;
+	if(self == NULL){
+		return;
+	}
+	std::lock_guard<std::mutex> lock(self->_topicsMutex);
+	RF24SNSharedTopicIndex topicIndex = self->findTopic(topic, RF24SNGateway::hashTopic(topic));
+	if(topicIndex == RF24SN_SHARED_TOPIC_NONE){
+		return;
+	}
+	RF24SNSharedTopic& shared = self->_topics[topicIndex];
+	shared.radios &= ~(1 << _currentRadio);
+	if(shared.radios != 0){
+		return;
+	}
+	// The broker unsubscribes the topic on its next update(), a refused topic is accepted again
+	shared.refused = false;
+	if(shared.upstream){
+		self->queuePending(topicIndex);
+	}
+	self->releaseTopic(topicIndex);
+}
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef RF24SNMultiGateway_h
+#define RF24SNMultiGateway_h
+
+#if defined(__linux__) && !defined(ARDUINO)
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "RF24SNGateway.h"
+#include "RF24SNSpscQueue.h"
+#include "RF24SNEventLoop.h"
+
+// Maximum number of radios a multi radio gateway can drive
+#ifndef RF24SN_MAX_RADIOS
+#define RF24SN_MAX_RADIOS 4
+#endif
+
+// Messages of a radio that can be waiting for the broker, must be a power of two
+#ifndef RF24SN_BROKER_QUEUE_SIZE
+#define RF24SN_BROKER_QUEUE_SIZE 64
+#endif
+
+// Number of distinct topics the clients of all radios can register for together
+#ifndef RF24SN_MAX_SHARED_TOPICS
+#define RF24SN_MAX_SHARED_TOPICS (RF24SN_MAX_TOPICS * RF24SN_MAX_RADIOS)
+#endif
+
+// Number of hash buckets in the shared topic index, must be a power of two
+#ifndef RF24SN_SHARED_TOPIC_BUCKETS
+#define RF24SN_SHARED_TOPIC_BUCKETS RF24SNPowerOfTwo<(RF24SN_MAX_SHARED_TOPICS + 1) / 2>::value
+#endif
+
+typedef RF24SNIndex<RF24SN_MAX_SHARED_TOPICS>::type RF24SNSharedTopicIndex;
+#define RF24SN_SHARED_TOPIC_NONE RF24SNIndex<RF24SN_MAX_SHARED_TOPICS>::NONE
+
+/**
+ * Called from update() for every message of a client
+ * @param radio Index of the radio the client is on, node addresses are only unique per radio
+ */
+typedef void (*radioMessageHandler)(uint8_t radio, RF24SNMessage& message);
+
+/**
+ * A struct representing a message of a client waiting for the broker
+ */
+struct RF24SNBrokerMessage{
+	RF24SNMessage message;
+
+	/**
+	 * Copy of the topic name of the message, the original only lives as long as the radio handler
+	 */
+	char topicName[RF24SN_TOPIC_LENGTH];
+};
+
+/**
+ * A struct representing a topic registered upstream for the clients of one or more radios
+ */
+struct RF24SNSharedTopic{
+	char topicName[RF24SN_TOPIC_LENGTH];
+
+	/**
+	 * Hash of the topic name, compared before the name itself
+	 */
+	uint16_t topicHash = 0;
+
+	/**
+	 * Bit n is set if the gateway of radio n has clients registered for the topic
+	 */
+	uint8_t radios = 0;
+
+	/**
+	 * True while the broker has the topic subscribed, only changed by update()
+	 */
+	bool upstream = false;
+
+	/**
+	 * True if the subscribe handler refused the topic, until no radio has clients for it
+	 */
+	bool refused = false;
+
+	/**
+	 * True while the topic waits for update() to subscribe or unsubscribe it
+	 */
+	bool pending = false;
+
+	/**
+	 * Next topic in the same bucket, the next filter, or the next free topic
+	 */
+	RF24SNSharedTopicIndex next = RF24SN_SHARED_TOPIC_NONE;
+
+	/**
+	 * Next topic waiting for update()
+	 */
+	RF24SNSharedTopicIndex nextPending = RF24SN_SHARED_TOPIC_NONE;
+};
+
+/**
+ * Counters of the queues between the radio threads and the broker
+ */
+struct RF24SNMultiGatewayStats{
+	/**
+	 * Values not forwarded because the queue of the radio was full
+	 */
+	uint32_t radioQueueDrops = 0;
+
+	/**
+	 * Messages of clients dropped because the broker did not call update() in time
+	 */
+	uint32_t brokerQueueDrops = 0;
+};
+
+/**
+ * A gateway driving several radios on different channels, each from its own thread
+ * Every radio has its own RF24SNGateway with its own clients, the upstream
+ * subscriptions are shared, so a topic is subscribed once for all radios
+ * Messages of the clients and values for the clients pass through lock free
+ * queues, update() and checkSubscription() must be called from the same
+ * (broker) thread, all handlers are called from update()
+ */
+class RF24SNMultiGateway{
+	static_assert(RF24SN_MAX_RADIOS <= 8, "RF24SN_MAX_RADIOS must fit in the radio bit mask");
+	static_assert(RF24SN_MAX_SHARED_TOPICS > 0 && RF24SN_MAX_SHARED_TOPICS < 65535, "RF24SN_MAX_SHARED_TOPICS must be between 1 and 65534");
+	static_assert((RF24SN_SHARED_TOPIC_BUCKETS & (RF24SN_SHARED_TOPIC_BUCKETS - 1)) == 0, "RF24SN_SHARED_TOPIC_BUCKETS must be a power of two");
+
+public:
+	/**
+	 * @param onSubsribeHandler Called from update() once the first client of any radio registered for a topic
+	 * The client was acked already, if the handler refuses the topic it gets no values and
+	 * later subscribes for the topic are refused until no client of any radio is registered for it
+	 */
+	RF24SNMultiGateway(radioMessageHandler onMessageHandler, subsribeHandler onSubsribeHandler);
+
+	/**
+	 * Stops the radio threads
+	 */
+	~RF24SNMultiGateway();
+
+	/**
+	 * Adds a radio, must be called before begin()
+	 * The config of every radio should use a different channel
+	 * @param irqFd Readable when the radio has a frame, see RF24SNEventLoop, -1 to poll the radio
+	 * @return Index of the radio, -1 if RF24SN_MAX_RADIOS are added already
+	 */
+	int8_t addRadio(RF24* radio, RF24Network* network, RF24SNConfig* config, int irqFd = -1);
+
+	/**
+	 * Gateway of a radio, to configure it before begin()
+	 */
+	RF24SNGateway& getGateway(uint8_t radio);
+
+	/**
+	 * Sets the handler to call from update() when no client of any radio is registered for a topic anymore
+	 */
+	void setUnsubscribeHandler(unsubscribeHandler onUnsubscribeHandler);
+
+	/**
+	 * Begins the gateways and starts a thread for every radio
+	 * @return False if the event loop of a radio could not be set up, no thread is started then
+	 */
+	bool begin(void);
+
+	/**
+	 * Stops the radio threads, begin() starts them again
+	 */
+	void end(void);
+
+	/**
+	 * Subscribes and unsubscribes the topics the clients registered for or left since
+	 * the last call, and passes the messages the clients sent to the message handler
+	 * This function should be called regularly
+	 */
+	void update(void);
+
+	/**
+	 * Queues a value for the radios with clients registered for the topic
+	 * The radio threads forward it like RF24SNGateway::checkSubscription()
+	 *
+	 * @return True if a radio has clients registered for the topic
+	 */
+	bool checkSubscription(const char* topic, float value);
+
+	/**
+	 * Counters of the queues, may be read from any thread
+	 */
+	RF24SNMultiGatewayStats getStats(void);
+
+private:
+	/**
+	 * A radio with its gateway, its thread and the queue of its messages for the broker
+	 */
+	struct Radio{
+		RF24SNGateway* gateway = NULL;
+		std::thread thread;
+
+		/**
+		 * The thread sleeps in the loop until a frame, a value or a timeout of the gateway
+		 */
+		RF24SNEventLoop loop;
+		int irqFd = -1;
+
+		RF24SNSpscQueue<RF24SNBrokerMessage, RF24SN_BROKER_QUEUE_SIZE> messages;
+	};
+
+	Radio _radios[RF24SN_MAX_RADIOS];
+	uint8_t _radioCount;
+
+	radioMessageHandler _onMessageHandler;
+	subsribeHandler _onSubsribeHandler;
+	unsubscribeHandler _onUnsubscribeHandler;
+
+	/**
+	 * True while the radio threads should run
+	 */
+	std::atomic<bool> _running;
+
+	/**
+	 * Topics registered by the clients of all radios, guarded by _topicsMutex like the indexes below
+	 */
+	RF24SNSharedTopic _topics[RF24SN_MAX_SHARED_TOPICS];
+	std::mutex _topicsMutex;
+
+	/**
+	 * Topic index, first topic in each bucket, filters are kept apart
+	 */
+	RF24SNSharedTopicIndex _topicBuckets[RF24SN_SHARED_TOPIC_BUCKETS];
+
+	/**
+	 * First topic with wildcards, every filter is matched against the published topics
+	 */
+	RF24SNSharedTopicIndex _filters;
+
+	/**
+	 * First unused topic, the free topics are chained through next
+	 */
+	RF24SNSharedTopicIndex _freeTopic;
+
+	/**
+	 * Oldest and newest topic the radio threads left for update() to subscribe or unsubscribe
+	 */
+	RF24SNSharedTopicIndex _pendingHead;
+	RF24SNSharedTopicIndex _pendingTail;
+
+	std::atomic<uint32_t> _radioQueueDrops;
+	std::atomic<uint32_t> _brokerQueueDrops;
+
+	/**
+	 * Gateway that owns the radio thread, the handlers of RF24SNGateway have no context
+	 */
+	static thread_local RF24SNMultiGateway* _currentGateway;
+
+	/**
+	 * Index of the radio of the thread
+	 */
+	static thread_local uint8_t _currentRadio;
+
+	/**
+	 * Updates a radio until end() is called
+	 */
+	void runRadio(uint8_t radio);
+
+	/**
+	 * Finds a shared topic, must be called with _topicsMutex locked like the functions below
+	 * @return RF24SN_SHARED_TOPIC_NONE if no radio registered the topic
+	 */
+	RF24SNSharedTopicIndex findTopic(const char* topic, uint16_t topicHash);
+
+	/**
+	 * Takes a free topic and adds it to the index
+	 * @return RF24SN_SHARED_TOPIC_NONE if all topics are used
+	 */
+	RF24SNSharedTopicIndex createTopic(const char* topic, uint16_t topicHash);
+
+	/**
+	 * Removes a topic from the index if no radio uses it and update() is done with it
+	 */
+	void releaseTopic(RF24SNSharedTopicIndex topicIndex);
+
+	/**
+	 * Leaves a topic for update() to subscribe or unsubscribe
+	 */
+	void queuePending(RF24SNSharedTopicIndex topicIndex);
+
+	/**
+	 * Handlers given to the gateways, called from the radio threads
+	 */
+	static void onRadioMessage(RF24SNMessage& message);
+	static bool onRadioSubscribe(const char* topic);
+	static void onRadioUnsubscribe(const char* topic);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef RF24SNSpscQueue_h
+#define RF24SNSpscQueue_h
+
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * Lock free queue between a single producer thread and a single consumer thread
+ * Only used by the Linux gateways, microcontrollers have no <atomic>
+ * @param Size Number of items the queue can hold, must be a power of two
+ */
+template<typename T, uint32_t Size>
+class RF24SNSpscQueue{
+	static_assert(Size > 0 && (Size & (Size - 1)) == 0, "Size must be a power of two");
+
+public:
+	RF24SNSpscQueue() : _head(0), _tail(0) {}
+
+	/**
+	 * Adds an item, may only be called by the producer
+	 * @return False if the queue is full
+	 */
+	bool push(const T& item){
+		uint32_t tail = _tail.load(std::memory_order_relaxed);
+		if(tail - _head.load(std::memory_order_acquire) == Size){
+			return false;
+		}
+		_items[tail & (Size - 1)] = item;
+		// Publishes the item to the consumer
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Takes the oldest item, may only be called by the consumer
+	 * @return False if the queue is empty
+	 */
+	bool pop(T& item){
+		uint32_t head = _head.load(std::memory_order_relaxed);
+		if(head == _tail.load(std::memory_order_acquire)){
+			return false;
+		}
+		item = _items[head & (Size - 1)];
+		// Hands the slot back to the producer
+		_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Number of items in the queue, only exact when called by the producer or the consumer
+	 */
+	uint32_t size(void) const{
+		return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+	}
+
+private:
+	/**
+	 * Next item to take, only written by the consumer
+	 */
+	std::atomic<uint32_t> _head;
+
+	/**
+	 * Keeps the counters on different cache lines, so the threads do not invalidate
+	 * each other's counter, padded rather than aligned as C++11 new ignores alignas
+	 */
+	uint8_t _padding[64 - sizeof(std::atomic<uint32_t>)];
+
+	/**
+	 * Next free slot, only written by the producer
+	 */
+	std::atomic<uint32_t> _tail;
+
+	T _items[Size];
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "RF24SNStorage.h"
+
+#if defined(ARDUINO)
+#include <EEPROM.h>
+
+RF24SNEepromStorage::RF24SNEepromStorage(uint16_t offset, uint16_t size){
+	_offset = offset;
+	_size = size;
+#if defined(ESP8266) || defined(ESP32)
+	_begun = false;
+#endif
+}
+
+#if defined(ESP8266) || defined(ESP32)
+void RF24SNEepromStorage::begin(void){
+	// Not from the constructor, a global storage is constructed before the core is up
+	if(!_begun){
+		EEPROM.begin(_offset + _size);
+		_begun = true;
+	}
+}
+#endif
+
+bool RF24SNEepromStorage::read(uint16_t address, void* data, uint16_t len){
+	if((uint32_t)address + len > _size){
+		return false;
+	}
+#if defined(ESP8266) || defined(ESP32)
+	RF24SNEepromStorage::begin();
+#endif
+	uint8_t* bytes = (uint8_t*)data;
+	for(uint16_t idx = 0; idx < len; idx++){
+		bytes[idx] = EEPROM.read(_offset + address + idx);
+	}
+	return true;
+}
+
+bool RF24SNEepromStorage::write(uint16_t address, const void* data, uint16_t len){
+	if((uint32_t)address + len > _size){
+		return false;
+	}
+#if defined(ESP8266) || defined(ESP32)
+	RF24SNEepromStorage::begin();
+#endif
+	const uint8_t* bytes = (const uint8_t*)data;
+	bool changed = false;
+	for(uint16_t idx = 0; idx < len; idx++){
+#if defined(ARDUINO_ARCH_AVR)
+		// update() skips bytes that did not change, every write wears the cell
+		EEPROM.update(_offset + address + idx, bytes[idx]);
+#else
+		// Not every core has update(), skip the bytes that did not change here
+		if(EEPROM.read(_offset + address + idx) != bytes[idx]){
+			EEPROM.write(_offset + address + idx, bytes[idx]);
+			changed = true;
+		}
+#endif
+	}
+#if defined(ESP8266) || defined(ESP32)
+	// write() only changed the copy in RAM, an unchanged sector is not erased again
+	if(changed){
+		return EEPROM.commit();
+	}
+#endif
+	(void)changed;
+	return true;
+}
+#else
+#include <stdio.h>
+
+RF24SNFileStorage::RF24SNFileStorage(const char* path){
+	_path = path;
+}
+
+bool RF24SNFileStorage::read(uint16_t address, void* data, uint16_t len){
+	FILE* file = fopen(_path, "rb");
+	if(file == NULL){
+		return false;
+	}
+	bool success = fseek(file, address, SEEK_SET) == 0 && fread(data, 1, len, file) == len;
+	fclose(file);
+	return success;
+}
+
+bool RF24SNFileStorage::write(uint16_t address, const void* data, uint16_t len){
+	FILE* file = fopen(_path, "r+b");
+	if(file == NULL){
+		file = fopen(_path, "w+b");
+	}
+	if(file == NULL){
+		return false;
+	}
+	bool success = fseek(file, address, SEEK_SET) == 0 && fwrite(data, 1, len, file) == len;
+	// fclose() flushes, a failed flush means the data did not reach the file
+	success = (fclose(file) == 0) && success;
+	return success;
+}
+#endif
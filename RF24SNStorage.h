@@ -0,0 +1,76 @@
+#ifndef RF24SNStorage_h
+#define RF24SNStorage_h
+
+#include <stdint.h>
+
+/**
+ * Non volatile storage used to keep state across reboots
+ * Implementations should only write bytes that changed, to spare the flash / EEPROM
+ */
+class RF24SNStorage{
+public:
+	virtual ~RF24SNStorage(){}
+
+	/**
+	 * Reads len bytes at address
+	 * @return False if the storage could not be read
+	 */
+	virtual bool read(uint16_t address, void* data, uint16_t len) = 0;
+
+	/**
+	 * Writes len bytes at address
+	 * @return False if the storage could not be written
+	 */
+	virtual bool write(uint16_t address, const void* data, uint16_t len) = 0;
+};
+
+#if defined(ARDUINO)
+/**
+ * Storage in the EEPROM of the microcontroller
+ * On the ESP8266 and ESP32 the EEPROM is a copy of a flash sector in RAM, it is
+ * set up on the first access and every write() commits it to the flash
+ */
+class RF24SNEepromStorage : public RF24SNStorage{
+public:
+	/**
+	 * @param offset First EEPROM address used, address 0 of the storage
+	 * @param size Number of EEPROM bytes that may be used
+	 */
+	RF24SNEepromStorage(uint16_t offset, uint16_t size);
+
+	bool read(uint16_t address, void* data, uint16_t len);
+	bool write(uint16_t address, const void* data, uint16_t len);
+
+private:
+	uint16_t _offset;
+	uint16_t _size;
+
+#if defined(ESP8266) || defined(ESP32)
+	/**
+	 * True once EEPROM.begin() read the flash sector
+	 */
+	bool _begun;
+
+	void begin(void);
+#endif
+};
+#else
+/**
+ * Storage in a file, stand-in for the EEPROM on Linux
+ */
+class RF24SNFileStorage : public RF24SNStorage{
+public:
+	/**
+	 * @param path File to store the data in, created when it does not exist
+	 */
+	RF24SNFileStorage(const char* path);
+
+	bool read(uint16_t address, void* data, uint16_t len);
+	bool write(uint16_t address, const void* data, uint16_t len);
+
+private:
+	const char* _path;
+};
+#endif
+
+#endif
@@ -0,0 +1,66 @@
+// Messages per second a gateway handles when 1000 PUBLISH frames are waiting for it
+//
+// The acks are deferred and sent from update(). For comparison the same run is
+// repeated with a message handler that blocks for 110 ms, like the delay(100)
+// before every ack and the delay(10) LED flash did before acks were deferred
+// Every frame takes 500 µs of airtime, about a full frame and its auto ack at 1 Mbps
+
+#include "RF24SNGateway.h"
+#include "sim.h"
+
+#define BENCH_SENDERS 4
+#define BENCH_MESSAGES 1000
+
+static bool blocking = false;
+static uint16_t handled = 0;
+
+void onMessage(RF24SNMessage& message){
+	(void)message;
+	if(blocking){
+		delay(110);
+	}
+	handled++;
+}
+
+static double run(bool blockingHandler){
+	blocking = blockingHandler;
+	handled = 0;
+	simResetCounters();
+
+	SimGateway<> fixture(onMessage);
+	RF24SNGateway& gateway = fixture.gateway;
+
+	RF24 radios[BENCH_SENDERS];
+	RF24Network* senders[BENCH_SENDERS];
+	for(uint8_t idx = 0; idx < BENCH_SENDERS; idx++){
+		senders[idx] = new RF24Network(radios[idx]);
+		senders[idx]->begin(SIM_CHANNEL, idx + 1);
+	}
+	for(uint16_t idx = 0; idx < BENCH_MESSAGES; idx++){
+		RF24NetworkHeader header(0, RF24SN_PUBLISH);
+		RF24SNPacket packet = {1, (float)idx};
+		senders[idx % BENCH_SENDERS]->write(header, &packet, sizeof(packet));
+	}
+
+	unsigned long start = millis();
+	while(simCounters().types[RF24SN_PUBACK] < BENCH_MESSAGES){
+		gateway.update();
+	}
+	unsigned long elapsed = millis() - start;
+	SIM_CHECK(handled == BENCH_MESSAGES);
+
+	for(uint8_t idx = 0; idx < BENCH_SENDERS; idx++){
+		delete senders[idx];
+	}
+	return BENCH_MESSAGES * 1000.0 / elapsed;
+}
+
+int main(void){
+	simSetAirtime(500);
+	double blockingRate = run(true);
+	double deferredRate = run(false);
+	printf("%u publishes from %u nodes: %.1f msg/s with blocking acks, %.1f msg/s with deferred acks\n",
+		BENCH_MESSAGES, BENCH_SENDERS, blockingRate, deferredRate);
+	SIM_CHECK(deferredRate > 10 * blockingRate);
+	return 0;
+}
@@ -0,0 +1,65 @@
+// Radio on time of a client that runs a duty cycle, while the broker publishes a
+// value for it every 500 ms for a minute
+//
+// The gateway holds the values while the client sleeps and sends them in its wake
+// window, a newer value replaces the one waiting. Each run reports the share of the time the radio of the client was
+// powered up and the radio on time per delivered value
+
+#include "RF24SNGateway.h"
+#include "sim.h"
+
+#define BENCH_TIME 60000
+#define BENCH_VALUE_INTERVAL 500
+
+static uint32_t delivered = 0;
+static float lastValue = -1;
+
+void onNodeMessage(RF24SNMessage& message){
+	delivered++;
+	lastValue = message.packet.value;
+}
+
+static void run(uint32_t sleepInterval, uint16_t wakeWindow){
+	delivered = 0;
+	lastValue = -1;
+	SimGateway<> fixture;
+	SimNode client(1, onNodeMessage);
+	RF24SNGateway& gateway = fixture.gateway;
+	RF24SN& node = client.node;
+
+	fixture.pump();
+	SIM_CHECK(node.subscribe("bench/duty") != (byte)RF24SN_RSP_FAILED);
+	simSetPump(NULL);
+	node.setDutyCycle(sleepInterval, wakeWindow);
+	node.resetStats();
+
+	uint32_t sent = 0;
+	unsigned long start = millis();
+	unsigned long nextValue = start;
+	while(millis() - start < BENCH_TIME){
+		if((long)(millis() - nextValue) >= 0){
+			gateway.checkSubscription("bench/duty", sent++);
+			nextValue += BENCH_VALUE_INTERVAL;
+		}
+		gateway.update();
+		node.update();
+	}
+	// The values sent during the last sleep arrive in the next wake window
+	unsigned long end = millis() + sleepInterval + wakeWindow + RF24SN_INITIAL_RTO;
+	while((long)(millis() - end) < 0 && lastValue != sent - 1){
+		gateway.update();
+		node.update();
+	}
+	uint32_t radioOnTime = node.getStats().radioOnTime;
+	printf("sleep %5u ms, wake window %3u ms: %u of %u values, newest %s, radio on %5u ms (%4.1f%%), %5.1f ms per value\n",
+		sleepInterval, wakeWindow, delivered, sent, lastValue == sent - 1 ? "delivered" : "lost",
+		radioOnTime, radioOnTime * 100.0 / BENCH_TIME, delivered > 0 ? (double)radioOnTime / delivered : 0.0);
+	SIM_CHECK(lastValue == sent - 1);
+}
+
+int main(void){
+	run(0, 0);
+	run(1000, 30);
+	run(5000, 30);
+	return 0;
+}
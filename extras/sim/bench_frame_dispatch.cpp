@@ -0,0 +1,99 @@
+// CPU time RF24SNGateway spends per received frame, from the read of the frame
+// to the end of its handler, and the number of peeks and reads per frame
+
+#include "RF24SNGateway.h"
+#include "sim.h"
+
+#include <chrono>
+
+#define BENCH_CLIENTS 4
+#define BENCH_FRAMES 4000
+#define BENCH_ROUNDS 200
+
+typedef RF24SNGatewayT<BENCH_CLIENTS, 2> BenchGateway;
+
+static uint32_t handled = 0;
+
+void onMessage(RF24SNMessage& message){
+	(void)message;
+	handled++;
+}
+
+int main(void){
+	SimGateway<BenchGateway> fixture(onMessage);
+	BenchGateway* gateway = &fixture.gateway;
+
+	// The clients register with a bulk subscribe that does not fit in a frame
+	SimNode* clients[BENCH_CLIENTS];
+	const char* const topics[] = {"bench/dispatch/a", "bench/dispatch/b"};
+	fixture.pump();
+	for(uint8_t idx = 0; idx < BENCH_CLIENTS; idx++){
+		clients[idx] = new SimNode(idx + 1);
+		byte topicIds[2];
+		SIM_CHECK(clients[idx]->node.subscribeMany(topics, 2, topicIds));
+		SIM_CHECK(topicIds[0] != (byte)RF24SN_RSP_FAILED && topicIds[1] != (byte)RF24SN_RSP_FAILED);
+	}
+	simSetPump(NULL);
+	// Only the CPU time counts from here on
+	simSetUpdateTime(0);
+
+	// A mix of the frames a gateway receives, written to it directly so only the gateway runs
+	double cpuTime = 0;
+	uint32_t peeks = 0;
+	uint32_t reads = 0;
+	for(uint16_t round = 0; round < BENCH_ROUNDS; round++){
+		for(uint16_t frame = 0; frame < BENCH_FRAMES; frame++){
+			RF24Network& network = clients[frame % BENCH_CLIENTS]->network;
+			uint8_t kind = frame % 8;
+			if(kind < 5){
+				RF24NetworkHeader header(0, RF24SN_PUBLISH);
+				RF24SNPacket packet = {1, (float)frame};
+				network.write(header, &packet, sizeof(packet));
+			}
+			else if(kind == 5){
+				RF24NetworkHeader header(0, RF24SN_PUBLISH_BATCH);
+				RF24SNPacket packets[3] = {{1, 1}, {1, 2}, {2, 3}};
+				network.write(header, packets, sizeof(packets));
+			}
+			else if(kind == 6){
+				RF24NetworkHeader header(0, RF24SN_PINGREQ);
+				network.write(header, NULL, 0);
+			}
+			else{
+				RF24NetworkHeader header(0, RF24SN_SUBSCRIBE);
+				RF24SNSubscribeRequest request;
+				memset(&request, 0, sizeof(request));
+				strcpy(request.topicName, topics[0]);
+				network.write(header, &request, sizeof(request));
+			}
+		}
+		simResetCounters();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		while(fixture.network.available()){
+			gateway->update();
+		}
+		cpuTime += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		peeks += simCounters().peeks;
+		reads += simCounters().reads;
+
+		// Send the deferred acks and throw them away
+		simAdvance(RF24SN_ACK_DELAY + 1);
+		gateway->update();
+		for(uint8_t idx = 0; idx < BENCH_CLIENTS; idx++){
+			RF24NetworkHeader header;
+			while(clients[idx]->network.available()){
+				clients[idx]->network.read(header, NULL, 0);
+			}
+		}
+	}
+	double frames = (double)BENCH_FRAMES * BENCH_ROUNDS;
+	printf("frame dispatch, %u clients: %.1f ns/frame, %.2f peeks/frame, %.2f reads/frame, %u values handled\n",
+		BENCH_CLIENTS, cpuTime / frames, peeks / frames, reads / frames, handled);
+	SIM_CHECK(reads == frames);
+	SIM_CHECK(handled > 0);
+
+	for(uint8_t idx = 0; idx < BENCH_CLIENTS; idx++){
+		delete clients[idx];
+	}
+	return 0;
+}
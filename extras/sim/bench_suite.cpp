@@ -0,0 +1,254 @@
+// Publish throughput, ack latency, fan-out time and subscribe storm recovery of
+// RF24SN and RF24SNGateway, all times are virtual except the CPU time of checkSubscription()
+
+#include "RF24SNGateway.h"
+#include "sim.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#define BENCH_CLIENTS 30
+#define BENCH_HOP_LATENCY 2
+#define BENCH_JITTER 3
+
+typedef RF24SNGatewayT<BENCH_CLIENTS, 2, RF24SN_TOPIC_LENGTH, BENCH_CLIENTS * 2, BENCH_CLIENTS * 2> BenchGateway;
+
+struct BenchClient : SimNode{
+	unsigned long startedAt[256];
+	float lastValue;
+	bool pending;
+	bool subscribed;
+
+	BenchClient(uint16_t address, messageHandler onMessage) :
+		SimNode(address, onMessage),
+		lastValue(-1),
+		pending(false),
+		subscribed(false){
+	}
+};
+
+static std::vector<BenchClient*> clients;
+static BenchClient* current = NULL;
+static std::vector<unsigned long> latencies;
+static uint32_t succeeded = 0;
+static uint32_t failed = 0;
+
+void onClientMessage(RF24SNMessage& message){
+	current->lastValue = message.packet.value;
+}
+
+void onComplete(const RF24SNRequest& request, bool success, const void* response, uint16_t responseLength){
+	(void)response;
+	(void)responseLength;
+	if(success){
+		succeeded++;
+		latencies.push_back(millis() - current->startedAt[request.handle]);
+	}
+	else{
+		failed++;
+	}
+}
+
+void onSubscribeComplete(const RF24SNRequest& request, bool success, const void* response, uint16_t responseLength){
+	onComplete(request, success, response, responseLength);
+	current->pending = false;
+	current->subscribed = success;
+}
+
+// Nodes 01 to 05 talk to the gateway directly, their children 011 to 055 over 2 hops
+static uint16_t clientAddress(uint8_t idx){
+	uint8_t parent = idx % 5 + 1;
+	return idx < 5 ? parent : parent | ((idx / 5) << 3);
+}
+
+static void startClients(uint8_t count){
+	for(uint8_t idx = 0; idx < count; idx++){
+		clients.push_back(new BenchClient(clientAddress(idx), onClientMessage));
+	}
+}
+
+static void stopClients(void){
+	for(size_t idx = 0; idx < clients.size(); idx++){
+		delete clients[idx];
+	}
+	clients.clear();
+}
+
+static void step(BenchGateway& gateway){
+	gateway.update();
+	for(size_t idx = 0; idx < clients.size(); idx++){
+		current = clients[idx];
+		current->node.update();
+	}
+	simAdvance(1);
+}
+
+static void resetResults(void){
+	latencies.clear();
+	succeeded = 0;
+	failed = 0;
+}
+
+static unsigned long percentile(uint8_t percent){
+	if(latencies.empty()){
+		return 0;
+	}
+	std::sort(latencies.begin(), latencies.end());
+	return latencies[(latencies.size() - 1) * percent / 100];
+}
+
+static void benchPublishThroughput(BenchGateway& gateway, uint16_t loss){
+	const unsigned long duration = 10000;
+	simSetLoss(loss);
+	resetResults();
+	startClients(1);
+	BenchClient& client = *clients[0];
+	unsigned long start = millis();
+	float value = 0;
+	while(millis() - start < duration){
+		// Keep every request slot busy
+		uint8_t handle;
+		while((handle = client.node.publishAsync(0, 1, value, 3, onComplete)) != RF24SN_INVALID_HANDLE){
+			client.startedAt[handle] = millis();
+			value++;
+		}
+		step(gateway);
+	}
+	printf("publish throughput, loss %u/1000: %.0f acked publishes/s, %u failed\n",
+		loss, succeeded * 1000.0 / duration, failed);
+	SIM_CHECK(succeeded > 0);
+	stopClients();
+}
+
+static void benchAckLatency(BenchGateway& gateway){
+	const unsigned long duration = 30000;
+	const unsigned long interval = 500;
+	simSetLoss(20);
+	resetResults();
+	startClients(BENCH_CLIENTS);
+	unsigned long start = millis();
+	while(millis() - start < duration){
+		unsigned long now = millis() - start;
+		// Every client publishes every interval, spread over the interval
+		for(uint8_t idx = 0; idx < BENCH_CLIENTS; idx++){
+			if(now % interval == idx * interval / BENCH_CLIENTS){
+				current = clients[idx];
+				uint8_t handle = current->node.publishAsync(0, 1, now, 3, onComplete);
+				if(handle != RF24SN_INVALID_HANDLE){
+					current->startedAt[handle] = millis();
+				}
+			}
+		}
+		step(gateway);
+	}
+	for(uint16_t idx = 0; idx < 10000; idx++){
+		step(gateway);
+	}
+	printf("ack latency, %u clients over 1-2 hops, loss 20/1000: p50 %lu ms, p90 %lu ms, p99 %lu ms, max %lu ms, %u acked, %u failed\n",
+		BENCH_CLIENTS, percentile(50), percentile(90), percentile(99), percentile(100), succeeded, failed);
+	SIM_CHECK(succeeded > 0);
+	stopClients();
+}
+
+static bool subscribeAll(BenchGateway& gateway, const char* topic){
+	resetResults();
+	for(size_t idx = 0; idx < clients.size(); idx++){
+		current = clients[idx];
+		current->startedAt[current->node.subscribeAsync(topic, onSubscribeComplete)] = millis();
+	}
+	for(uint16_t pass = 0; pass < 60000 && succeeded + failed < clients.size(); pass++){
+		step(gateway);
+	}
+	return succeeded == clients.size();
+}
+
+static void benchFanOut(BenchGateway& gateway){
+	const uint8_t rounds = 20;
+	simSetLoss(0);
+	startClients(BENCH_CLIENTS);
+	SIM_CHECK(subscribeAll(gateway, "bench/fanout"));
+
+	double cpuTime = 0;
+	unsigned long deliveryTime = 0;
+	for(uint8_t round = 0; round < rounds; round++){
+		unsigned long start = millis();
+		std::chrono::steady_clock::time_point cpuStart = std::chrono::steady_clock::now();
+		gateway.checkSubscription("bench/fanout", round);
+		cpuTime += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - cpuStart).count();
+
+		uint8_t delivered = 0;
+		for(uint32_t pass = 0; pass < 60000 && delivered < BENCH_CLIENTS; pass++){
+			step(gateway);
+			delivered = 0;
+			for(uint8_t idx = 0; idx < BENCH_CLIENTS; idx++){
+				delivered += clients[idx]->lastValue == round;
+			}
+		}
+		SIM_CHECK(delivered == BENCH_CLIENTS);
+		deliveryTime += millis() - start;
+	}
+	printf("fan-out to %u clients: all delivered after %.1f ms, checkSubscription() %.2f us CPU\n",
+		BENCH_CLIENTS, deliveryTime / (double)rounds, cpuTime / rounds);
+	stopClients();
+}
+
+static void benchSubscribeStorm(BenchGateway& gateway){
+	simSetLoss(20);
+	resetResults();
+	// A power restore, all clients boot at once and subscribe, failed subscribes are repeated
+	startClients(BENCH_CLIENTS);
+	unsigned long start = millis();
+	uint32_t repeated = 0;
+	uint8_t subscribed = 0;
+	while(subscribed < BENCH_CLIENTS && millis() - start < 600000){
+		subscribed = 0;
+		for(uint8_t idx = 0; idx < BENCH_CLIENTS; idx++){
+			current = clients[idx];
+			if(current->subscribed){
+				subscribed++;
+			}
+			else if(!current->pending){
+				uint8_t handle = current->node.subscribeAsync("bench/storm", onSubscribeComplete);
+				if(handle != RF24SN_INVALID_HANDLE){
+					repeated += millis() != start;
+					current->startedAt[handle] = millis();
+					current->pending = true;
+				}
+			}
+		}
+		step(gateway);
+	}
+	printf("subscribe storm of %u clients, loss 20/1000: all subscribed after %lu ms, p50 %lu ms, slowest %lu ms, %u subscribes repeated\n",
+		BENCH_CLIENTS, millis() - start, percentile(50), percentile(100), repeated);
+	SIM_CHECK(subscribed == BENCH_CLIENTS);
+	stopClients();
+}
+
+int main(void){
+	srand(1);
+	simSetUpdateTime(0);
+	simSetLatency(BENCH_HOP_LATENCY, BENCH_JITTER);
+
+	// Every benchmark gets a freshly booted gateway
+	SimGateway<BenchGateway>* fixture = new SimGateway<BenchGateway>();
+	benchPublishThroughput(fixture->gateway, 0);
+	delete fixture;
+
+	fixture = new SimGateway<BenchGateway>();
+	benchPublishThroughput(fixture->gateway, 50);
+	delete fixture;
+
+	fixture = new SimGateway<BenchGateway>();
+	benchAckLatency(fixture->gateway);
+	delete fixture;
+
+	fixture = new SimGateway<BenchGateway>();
+	benchFanOut(fixture->gateway);
+	delete fixture;
+
+	fixture = new SimGateway<BenchGateway>();
+	benchSubscribeStorm(fixture->gateway);
+	delete fixture;
+	return 0;
+}
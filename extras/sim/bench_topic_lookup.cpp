@@ -0,0 +1,64 @@
+// CPU time of checkSubscription() against the number of registered clients
+// Every client registers BENCH_TOPICS topics of its own, the lookups hit
+// a topic of one client or miss all of them
+
+#include "RF24SNGateway.h"
+#include "sim.h"
+
+#include <chrono>
+
+#define BENCH_TOPICS 4
+#define BENCH_LOOKUPS 20000
+
+template<uint16_t Clients> static void bench(void){
+	typedef RF24SNGatewayT<Clients, BENCH_TOPICS, RF24SN_TOPIC_LENGTH, Clients * BENCH_TOPICS, Clients> Gateway;
+	SimGateway<Gateway>* fixture = new SimGateway<Gateway>();
+	Gateway* gateway = &fixture->gateway;
+	RF24Network clientNetwork(fixture->radio);
+
+	// One network takes the address of every client in turn
+	for(uint16_t client = 1; client <= Clients; client++){
+		clientNetwork.begin(SIM_CHANNEL, client);
+		for(uint8_t topic = 0; topic < BENCH_TOPICS; topic++){
+			RF24NetworkHeader header(0, RF24SN_SUBSCRIBE);
+			RF24SNSubscribeRequest request = {};
+			snprintf(request.topicName, sizeof(request.topicName), "room/%u/t%u", client, topic);
+			clientNetwork.write(header, &request, sizeof(request));
+		}
+		gateway->update();
+	}
+	SIM_CHECK(gateway->getStats().clientRegistrations == Clients);
+
+	char topics[64][RF24SN_TOPIC_LENGTH];
+	for(uint8_t idx = 0; idx < 64; idx++){
+		snprintf(topics[idx], RF24SN_TOPIC_LENGTH, "room/%u/t%u", 1 + idx * 7 % Clients, idx % BENCH_TOPICS);
+	}
+	uint32_t hits = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(uint16_t idx = 0; idx < BENCH_LOOKUPS; idx++){
+		hits += gateway->checkSubscription(topics[idx % 64], idx);
+	}
+	double hitTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_LOOKUPS;
+
+	for(uint8_t idx = 0; idx < 64; idx++){
+		snprintf(topics[idx], RF24SN_TOPIC_LENGTH, "hall/%u/t%u", 1 + idx * 7 % Clients, idx % BENCH_TOPICS);
+	}
+	start = std::chrono::steady_clock::now();
+	for(uint16_t idx = 0; idx < BENCH_LOOKUPS; idx++){
+		hits += gateway->checkSubscription(topics[idx % 64], idx);
+	}
+	double missTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_LOOKUPS;
+	SIM_CHECK(hits == BENCH_LOOKUPS);
+
+	printf("%4u clients, %4u topics: %6.0f ns per hit, %6.0f ns per miss\n", Clients, Clients * BENCH_TOPICS, hitTime, missTime);
+	delete fixture;
+}
+
+int main(void){
+	bench<4>();
+	bench<16>();
+	bench<64>();
+	bench<256>();
+	bench<1024>();
+	return 0;
+}
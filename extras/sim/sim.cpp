@@ -0,0 +1,366 @@
+#include "sim.h"
+#include "Arduino.h"
+#include "EEPROM.h"
+
+#include <string.h>
+#include <map>
+#include <vector>
+#include <deque>
+#include <mutex>
+
+#if defined(RF24SN_SIM_REALTIME)
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#endif
+
+thread_local uint16_t RF24NetworkHeader::next_id = 1;
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+namespace{
+
+struct Frame{
+	RF24NetworkHeader header;
+	std::vector<uint8_t> payload;
+	unsigned long deliverAt;
+};
+
+struct Node{
+	RF24Network* network;
+	uint8_t channel;
+	uint16_t address;
+	std::deque<Frame> frames;
+	int irqFd;
+};
+
+std::recursive_mutex simMutex;
+std::map<RF24Network*, Node*> nodesByNetwork;
+std::map<uint32_t, Node*> nodesByKey;
+std::map<uint16_t, bool> downNodes;
+SimCounters counters;
+
+unsigned long updateTime = 1;
+uint16_t loss = 0;
+uint16_t hopLatency = 0;
+uint16_t latencyJitter = 0;
+void (*pumpHandler)(void) = NULL;
+bool pumping = false;
+
+#if defined(RF24SN_SIM_REALTIME)
+const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+uint16_t airtime = 300;
+std::mutex channelMutex[128];
+#else
+uint16_t airtime = 0;
+// In µs, so the airtime of short frames adds up
+unsigned long long virtualNow = 0;
+#endif
+
+uint32_t nodeKey(uint8_t channel, uint16_t address){
+	return ((uint32_t)channel << 16) | address;
+}
+
+Node& nodeOf(RF24Network* network){
+	return *nodesByNetwork.at(network);
+}
+
+// Depth of an octal RF24Network address, 0 for the master
+uint8_t depth(uint16_t address){
+	uint8_t levels = 0;
+	while(address != 0){
+		address >>= 3;
+		levels++;
+	}
+	return levels;
+}
+
+// Address of the ancestor of a node on a given level
+uint16_t ancestor(uint16_t address, uint8_t level){
+	return level == 0 ? 0 : address & ((1 << (3 * level)) - 1);
+}
+
+bool isAvailable(Node& node){
+	return !node.frames.empty() && (long)(millis() - node.frames.front().deliverAt) >= 0;
+}
+
+}
+
+unsigned long millis(void){
+#if defined(RF24SN_SIM_REALTIME)
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+#else
+	return virtualNow / 1000;
+#endif
+}
+
+void delay(unsigned long ms){
+	simAdvance(ms);
+}
+
+long random(long max){
+	return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max){
+	return min + random(max - min);
+}
+
+void pinMode(uint8_t pin, uint8_t mode){
+	(void)pin;
+	(void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value){
+	(void)pin;
+	(void)value;
+}
+
+void HardwareSerial::print(const char* text){
+	fputs(text, stdout);
+}
+
+void HardwareSerial::print(long value, int base){
+	printf(base == 16 ? "%lx" : "%ld", value);
+}
+
+void HardwareSerial::print(unsigned long value, int base){
+	printf(base == 16 ? "%lx" : "%lu", value);
+}
+
+void HardwareSerial::print(double value, int digits){
+	printf("%.*f", digits, value);
+}
+
+void simAdvance(unsigned long ms){
+#if defined(RF24SN_SIM_REALTIME)
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+#else
+	virtualNow += ms * 1000ULL;
+#endif
+}
+
+void simSetUpdateTime(unsigned long ms){
+	updateTime = ms;
+}
+
+void simSetPump(void (*pump)(void)){
+	pumpHandler = pump;
+}
+
+void simSetLoss(uint16_t perMille){
+	loss = perMille;
+}
+
+void simSetLatency(uint16_t latency, uint16_t jitter){
+	hopLatency = latency;
+	latencyJitter = jitter;
+}
+
+void simSetAirtime(uint16_t frameAirtime){
+	airtime = frameAirtime;
+}
+
+void simSetNodeDown(uint16_t nodeAddress, bool down){
+	std::lock_guard<std::recursive_mutex> lock(simMutex);
+	downNodes[nodeAddress] = down;
+}
+
+uint8_t simHops(uint16_t from, uint16_t to){
+	uint8_t fromDepth = depth(from);
+	uint8_t toDepth = depth(to);
+	uint8_t common = fromDepth < toDepth ? fromDepth : toDepth;
+	while(common > 0 && ancestor(from, common) != ancestor(to, common)){
+		common--;
+	}
+	return fromDepth + toDepth - 2 * common;
+}
+
+int simRadioFd(RF24Network* network){
+#if defined(RF24SN_SIM_REALTIME)
+	std::lock_guard<std::recursive_mutex> lock(simMutex);
+	Node& node = nodeOf(network);
+	if(node.irqFd < 0){
+		node.irqFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	}
+	return node.irqFd;
+#else
+	(void)network;
+	return -1;
+#endif
+}
+
+const SimCounters& simCounters(void){
+	return counters;
+}
+
+void simResetCounters(void){
+	std::lock_guard<std::recursive_mutex> lock(simMutex);
+	memset(&counters, 0, sizeof(counters));
+}
+
+RF24Network::~RF24Network(){
+	std::lock_guard<std::recursive_mutex> lock(simMutex);
+	std::map<RF24Network*, Node*>::iterator it = nodesByNetwork.find(this);
+	if(it == nodesByNetwork.end()){
+		return;
+	}
+	Node* node = it->second;
+	if(nodesByKey[nodeKey(node->channel, node->address)] == node){
+		nodesByKey.erase(nodeKey(node->channel, node->address));
+	}
+#if defined(RF24SN_SIM_REALTIME)
+	if(node->irqFd >= 0){
+		close(node->irqFd);
+	}
+#endif
+	nodesByNetwork.erase(it);
+	delete node;
+}
+
+void RF24Network::begin(uint8_t channel, uint16_t node_address){
+	std::lock_guard<std::recursive_mutex> lock(simMutex);
+	Node* node = nodesByNetwork[this];
+	if(node == NULL){
+		node = new Node();
+		node->network = this;
+		node->irqFd = -1;
+		nodesByNetwork[this] = node;
+	}
+	else if(nodesByKey[nodeKey(node->channel, node->address)] == node){
+		nodesByKey.erase(nodeKey(node->channel, node->address));
+	}
+	node->channel = channel;
+	node->address = node_address;
+	node->frames.clear();
+	// A rebooted node takes the address over from its previous instance
+	nodesByKey[nodeKey(channel, node_address)] = node;
+}
+
+uint8_t RF24Network::update(void){
+#if !defined(RF24SN_SIM_REALTIME)
+	virtualNow += updateTime * 1000ULL;
+#endif
+	if(pumpHandler != NULL && !pumping){
+		pumping = true;
+		pumpHandler();
+		pumping = false;
+	}
+	return 0;
+}
+
+bool RF24Network::available(void){
+	std::lock_guard<std::recursive_mutex> lock(simMutex);
+	return isAvailable(nodeOf(this));
+}
+
+uint16_t RF24Network::peek(RF24NetworkHeader& header){
+	std::lock_guard<std::recursive_mutex> lock(simMutex);
+	counters.peeks++;
+	Node& node = nodeOf(this);
+	if(!isAvailable(node)){
+		return 0;
+	}
+	header = node.frames.front().header;
+	return node.frames.front().payload.size();
+}
+
+uint16_t RF24Network::read(RF24NetworkHeader& header, void* message, uint16_t maxlen){
+	std::lock_guard<std::recursive_mutex> lock(simMutex);
+	counters.reads++;
+	Node& node = nodeOf(this);
+	if(!isAvailable(node)){
+		return 0;
+	}
+	Frame& frame = node.frames.front();
+	header = frame.header;
+	uint16_t len = frame.payload.size() < maxlen ? frame.payload.size() : maxlen;
+	if(message != NULL && len > 0){
+		memcpy(message, frame.payload.data(), len);
+	}
+	node.frames.pop_front();
+	return len;
+}
+
+bool RF24Network::write(RF24NetworkHeader& header, const void* message, uint16_t len){
+#if defined(RF24SN_SIM_REALTIME)
+	uint8_t channel;
+	{
+		std::lock_guard<std::recursive_mutex> lock(simMutex);
+		channel = nodeOf(this).channel;
+	}
+	{
+		// The channel is busy while the frame is on the air
+		std::lock_guard<std::mutex> onAir(channelMutex[channel & 127]);
+		std::this_thread::sleep_for(std::chrono::microseconds(airtime));
+	}
+#else
+	// One node sends at a time, the sender waits for its frame to be on the air
+	virtualNow += airtime;
+#endif
+	std::lock_guard<std::recursive_mutex> lock(simMutex);
+	Node& from = nodeOf(this);
+	counters.writes++;
+	counters.types[header.type]++;
+	header.from_node = from.address;
+
+	std::map<uint32_t, Node*>::iterator target = nodesByKey.find(nodeKey(from.channel, header.to_node));
+	if(target == nodesByKey.end() || downNodes[header.to_node] || target->second->network->radio().isPoweredDown()){
+		return false;
+	}
+
+	uint8_t hops = simHops(from.address, header.to_node);
+	unsigned long latency = 0;
+	for(uint8_t hop = 0; hop < hops; hop++){
+		if(loss > 0 && random(1000) < loss){
+			// Lost after the radio acked it, like a frame dropped from a full RX FIFO
+			counters.lost++;
+			return true;
+		}
+		latency += hopLatency + (latencyJitter > 0 ? random(latencyJitter + 1) : 0);
+	}
+
+	Frame frame;
+	frame.header = header;
+	frame.payload.assign((const uint8_t*)message, (const uint8_t*)message + len);
+	frame.deliverAt = millis() + latency;
+
+	// Frames with jitter may overtake each other, the queue stays ordered by delivery time
+	std::deque<Frame>& frames = target->second->frames;
+	std::deque<Frame>::iterator position = frames.end();
+	while(position != frames.begin() && (long)((position - 1)->deliverAt - frame.deliverAt) > 0){
+		position--;
+	}
+	frames.insert(position, frame);
+
+#if defined(RF24SN_SIM_REALTIME)
+	if(target->second->irqFd >= 0){
+		uint64_t one = 1;
+		if(::write(target->second->irqFd, &one, sizeof(one)) < 0){
+			// The counter is full, the node is signalled already
+		}
+	}
+#endif
+	return true;
+}
+
+void simIgnoreMessage(RF24SNMessage& message){
+	(void)message;
+}
+
+bool simAcceptSubscribe(const char* topic){
+	(void)topic;
+	return true;
+}
+
+RF24SNConfig simConfig(uint16_t nodeAddress, uint8_t channel){
+	RF24SNConfig config = {0, nodeAddress, RF24_1MBPS, 0, channel};
+	return config;
+}
+
+SimNode::SimNode(uint16_t nodeAddress, messageHandler onMessage, uint8_t channel)
+	: network(radio), config(simConfig(nodeAddress, channel)), node(&radio, &network, &config, onMessage){
+	node.begin();
+}
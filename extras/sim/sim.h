@@ -0,0 +1,192 @@
+#ifndef RF24SNSim_h
+#define RF24SNSim_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "RF24Network.h"
+#include "RF24SNGateway.h"
+
+/**
+ * Simulated radio network for host builds of RF24SN
+ *
+ * The RF24 and RF24Network headers in stubs/ replace the radio drivers. Every
+ * RF24Network that called begin() is a node of one shared network, nodes only
+ * hear nodes on the same channel. Frames travel along the RF24Network tree, a
+ * frame from 011 to 02 takes 3 hops (011 -> 01 -> 00 -> 02), every hop adds
+ * latency and may lose the frame
+ *
+ * Two clocks are available:
+ * - the virtual clock (default) only moves with delay(), simAdvance(),
+ *   RF24Network::update() and the airtime of written frames, runs are
+ *   repeatable and fast, but all nodes must be driven from one thread
+ * - the real time clock (built with RF24SN_SIM_REALTIME) follows the steady
+ *   clock of the host, the network is thread safe, frames share the airtime
+ *   of their channel and a node can get an IRQ file descriptor, this is for the Linux only classes
+ */
+
+// Fails the running test when condition is false
+#define SIM_CHECK(condition) do{ \
+		if(!(condition)){ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			exit(1); \
+		} \
+	}while(0)
+
+/**
+ * Counters of the simulated network
+ */
+struct SimCounters{
+	/**
+	 * Calls of RF24Network::write()
+	 */
+	uint32_t writes;
+
+	/**
+	 * Frames lost on one of their hops
+	 */
+	uint32_t lost;
+
+	/**
+	 * Calls of RF24Network::peek()
+	 */
+	uint32_t peeks;
+
+	/**
+	 * Calls of RF24Network::read()
+	 */
+	uint32_t reads;
+
+	/**
+	 * Frames written per header type
+	 */
+	uint32_t types[256];
+};
+
+/**
+ * Moves the virtual clock forward by ms, sleeps for ms with the real time clock
+ */
+void simAdvance(unsigned long ms);
+
+/**
+ * Time the virtual clock moves forward on every RF24Network::update(), 1 ms by default
+ * Keeps loops that poll the radio moving forward in time, unused with the real time clock
+ */
+void simSetUpdateTime(unsigned long ms);
+
+/**
+ * Called from every RF24Network::update() that is not already inside pump
+ * Lets the other nodes run while a node is blocked in a call, NULL to disable
+ */
+void simSetPump(void (*pump)(void));
+
+/**
+ * Chance to lose a frame on each hop, in 1/1000
+ * A lost frame was acked by the radio, the write still succeeds
+ */
+void simSetLoss(uint16_t perMille);
+
+/**
+ * Time in ms each hop adds to the delivery of a frame, plus up to jitter ms at random
+ */
+void simSetLatency(uint16_t hopLatency, uint16_t jitter = 0);
+
+/**
+ * Time in µs a frame occupies its channel, the write returns once it passed
+ * 0 by default on the virtual clock, 300 with the real time clock
+ */
+void simSetAirtime(uint16_t airtime);
+
+/**
+ * A node that is down does not ack, writes to it fail
+ */
+void simSetNodeDown(uint16_t nodeAddress, bool down);
+
+/**
+ * Number of hops between two nodes of the RF24Network tree
+ */
+uint8_t simHops(uint16_t from, uint16_t to);
+
+/**
+ * File descriptor that becomes readable when a frame is queued for the node,
+ * stands in for the IRQ line of the radio, only with the real time clock
+ */
+int simRadioFd(RF24Network* network);
+
+/**
+ * Counters since the start or the last simResetCounters()
+ */
+const SimCounters& simCounters(void);
+
+void simResetCounters(void);
+
+/*
+ * Fixtures for the tests and benchmarks: a gateway on node 0 and nodes with
+ * their own radio, network and config, begun on construction. They keep
+ * pointers to their members, so they are neither copied nor moved
+ */
+
+// Channel of the fixtures unless another one is given
+#define SIM_CHANNEL 90
+
+/**
+ * Message handler that drops the message, for nodes whose messages a test does not look at
+ */
+void simIgnoreMessage(RF24SNMessage& message);
+
+/**
+ * Subscribe handler that accepts every topic
+ */
+bool simAcceptSubscribe(const char* topic);
+
+/**
+ * Config of a node of the simulated network, 1 MBPS on SIM_CHANNEL by default
+ */
+RF24SNConfig simConfig(uint16_t nodeAddress, uint8_t channel = SIM_CHANNEL);
+
+/**
+ * A node of the simulated network
+ */
+struct SimNode{
+	RF24 radio;
+	RF24Network network;
+	RF24SNConfig config;
+	RF24SN node;
+
+	SimNode(uint16_t nodeAddress, messageHandler onMessage = simIgnoreMessage, uint8_t channel = SIM_CHANNEL);
+};
+
+/**
+ * The gateway of the simulated network, Gateway sets the table sizes, see RF24SNGatewayT
+ */
+template<typename Gateway = RF24SNGateway> struct SimGateway{
+	RF24 radio;
+	RF24Network network;
+	RF24SNConfig config;
+	Gateway gateway;
+
+	SimGateway(messageHandler onMessage = simIgnoreMessage, subsribeHandler onSubscribe = simAcceptSubscribe, uint8_t channel = SIM_CHANNEL)
+		: network(radio), config(simConfig(0, channel)), gateway(&radio, &network, &config, onMessage, onSubscribe){
+		gateway.begin();
+	}
+
+	/**
+	 * Runs the gateway while a node waits in a blocking request, until simSetPump(NULL)
+	 */
+	void pump(void){
+		pumped() = this;
+		simSetPump(update);
+	}
+
+private:
+	static SimGateway*& pumped(void){
+		static SimGateway* fixture = NULL;
+		return fixture;
+	}
+
+	static void update(void){
+		pumped()->gateway.update();
+	}
+};
+
+#endif
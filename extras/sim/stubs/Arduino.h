@@ -0,0 +1,43 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+// Just the part of the Arduino core RF24SN uses, millis() and delay() run on the simulated clock
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define DEC 10
+#define F(x) (x)
+
+unsigned long millis(void);
+void delay(unsigned long ms);
+long random(long max);
+long random(long min, long max);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+
+/**
+ * Serial port that prints to stdout
+ */
+class HardwareSerial{
+public:
+	void print(const char* text);
+	void print(long value, int base = DEC);
+	void print(unsigned long value, int base = DEC);
+	void print(int value, int base = DEC){ print((long)value, base); }
+	void print(unsigned int value, int base = DEC){ print((unsigned long)value, base); }
+	void print(double value, int digits = 2);
+	template<class T> void println(T value){ print(value); println(); }
+	template<class T> void println(T value, int format){ print(value, format); println(); }
+	void println(void){ print("\n"); }
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEPROM_SIZE 1024
+
+#if defined(ESP8266) || defined(ESP32)
+/**
+ * The EEPROM library of the ESP cores, kept in memory
+ * Reads and writes go to a copy that begin() takes from the flash, only commit() writes it back
+ */
+class EEPROMClass{
+public:
+	void begin(uint16_t size){
+		_size = size > EEPROM_SIZE ? EEPROM_SIZE : size;
+		memcpy(_copy, _flash, _size);
+	}
+	uint8_t read(int address){ return address < _size ? _copy[address] : 0; }
+	void write(int address, uint8_t value){
+		if(address < _size){
+			_copy[address] = value;
+		}
+	}
+	bool commit(void){
+		if(_size == 0){
+			return false;
+		}
+		memcpy(_flash, _copy, _size);
+		return true;
+	}
+	uint16_t length(void){ return _size; }
+
+	/**
+	 * Byte as kept in the flash across a reboot, only for the tests
+	 */
+	uint8_t stored(int address){ return _flash[address]; }
+
+private:
+	uint16_t _size = 0;
+	uint8_t _copy[EEPROM_SIZE] = {};
+	uint8_t _flash[EEPROM_SIZE] = {};
+};
+#else
+/**
+ * The AVR EEPROM library, kept in memory
+ */
+class EEPROMClass{
+public:
+	uint8_t read(int address){ return _data[address]; }
+	void write(int address, uint8_t value){ _data[address] = value; }
+	void update(int address, uint8_t value){ _data[address] = value; }
+	uint16_t length(void){ return EEPROM_SIZE; }
+
+	/**
+	 * Byte as kept across a reboot, only for the tests
+	 */
+	uint8_t stored(int address){ return _data[address]; }
+
+private:
+	uint8_t _data[EEPROM_SIZE] = {};
+};
+#endif
+
+extern EEPROMClass EEPROM;
+
+#endif
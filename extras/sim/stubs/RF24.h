@@ -0,0 +1,36 @@
+#ifndef RF24_h
+#define RF24_h
+
+// Simulated nRF24L01 driver, the frames are exchanged by RF24Network
+
+#include <stdint.h>
+
+// Like RF24 on Linux, the host build gets the clock from the radio driver
+unsigned long millis(void);
+void delay(unsigned long ms);
+
+typedef enum { RF24_1MBPS = 0, RF24_2MBPS, RF24_250KBPS } rf24_datarate_e;
+
+typedef enum { RF24_PA_MIN = 0, RF24_PA_LOW, RF24_PA_HIGH, RF24_PA_MAX } rf24_pa_dbm_e;
+
+class RF24{
+public:
+	bool begin(void){ return true; }
+	bool setDataRate(rf24_datarate_e speed){ (void)speed; return true; }
+	void setPALevel(uint8_t level){ (void)level; }
+	void setAutoAck(bool enable){ (void)enable; }
+	void startListening(void){}
+	void stopListening(void){}
+
+	/**
+	 * Frames sent to a powered down radio are lost
+	 */
+	void powerDown(void){ _poweredDown = true; }
+	void powerUp(void){ _poweredDown = false; }
+	bool isPoweredDown(void){ return _poweredDown; }
+
+private:
+	bool _poweredDown = false;
+};
+
+#endif
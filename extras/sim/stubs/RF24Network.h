@@ -0,0 +1,48 @@
+#ifndef RF24Network_h
+#define RF24Network_h
+
+// Simulated RF24Network, see sim.h for the knobs of the simulated network
+
+#include <stdint.h>
+#include "RF24.h"
+
+#define MAX_FRAME_SIZE 32
+#define MAX_PAYLOAD_SIZE 144
+
+struct RF24NetworkHeader{
+	uint16_t from_node;
+	uint16_t to_node;
+	uint16_t id;
+	unsigned char type;
+	unsigned char reserved;
+
+	// One counter per thread, as every radio thread of a host build has its own network
+	static thread_local uint16_t next_id;
+
+	RF24NetworkHeader(){}
+	RF24NetworkHeader(uint16_t _to, unsigned char _type = 0) : to_node(_to), id(next_id++), type(_type){}
+};
+
+class RF24Network{
+public:
+	RF24Network(RF24& radio) : _radio(radio){}
+
+	/**
+	 * Leaves the simulated network, frames still queued for the node are dropped
+	 */
+	~RF24Network();
+
+	void begin(uint8_t channel, uint16_t node_address);
+	uint8_t update(void);
+	bool available(void);
+	uint16_t peek(RF24NetworkHeader& header);
+	uint16_t read(RF24NetworkHeader& header, void* message, uint16_t maxlen);
+	bool write(RF24NetworkHeader& header, const void* message, uint16_t len);
+
+	RF24& radio(void){ return _radio; }
+
+private:
+	RF24& _radio;
+};
+
+#endif
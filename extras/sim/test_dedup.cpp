@@ -0,0 +1,88 @@
+// Retries of a publish reach the message handler once, and a node that restarts
+// is not taken for a retry of the publishes it sent before
+
+#include "RF24SNGateway.h"
+#include "sim.h"
+
+#include <set>
+
+static uint16_t handled = 0;
+static std::set<int> handledValues;
+static uint16_t acked = 0;
+static uint16_t failed = 0;
+
+void onMessage(RF24SNMessage& message){
+	handled++;
+	handledValues.insert((int)message.packet.value);
+}
+
+void onComplete(const RF24SNRequest& request, bool success, const void* response, uint16_t responseLength){
+	(void)request;
+	(void)response;
+	(void)responseLength;
+	success ? acked++ : failed++;
+}
+
+static void run(RF24SNGateway& gateway, RF24SN& node){
+	for(uint32_t pass = 0; pass < 100000 && node.getUpdateTimeout() != RF24SN_NO_TIMEOUT; pass++){
+		gateway.update();
+		node.update();
+	}
+	// Let the last deferred acks go out
+	for(uint8_t pass = 0; pass < 20; pass++){
+		gateway.update();
+		node.update();
+	}
+}
+
+// The usual boot of a battery node: subscribe, publish a few values, sleep or reset
+static void boot(RF24SNGateway& gateway, int firstValue){
+	SimNode client(1);
+	RF24SN& node = client.node;
+	SIM_CHECK(node.subscribeAsync("node/1", onComplete) != RF24SN_INVALID_HANDLE);
+	run(gateway, node);
+	// Three values, more than the request table of a board holds at once
+	for(int value = firstValue; value < firstValue + 3; value++){
+		while(node.publishAsync(0, 1, value, 3, onComplete) == RF24SN_INVALID_HANDLE){
+			gateway.update();
+			node.update();
+		}
+	}
+	run(gateway, node);
+}
+
+int main(void){
+	SimGateway<> fixture(onMessage);
+	RF24SNGateway& gateway = fixture.gateway;
+
+	// Reboot followed by publish
+	boot(gateway, 0);
+	boot(gateway, 10);
+	SIM_CHECK(acked == 8 && failed == 0);
+	SIM_CHECK(handled == 6);
+	SIM_CHECK(gateway.getStats().duplicates == 0);
+
+	// Lost acks make the node retry, each value is still handled once
+	// A retry of the first request looks like another restart, so that one goes through without loss
+	SimNode client(1);
+	RF24SN& node = client.node;
+	SIM_CHECK(node.subscribeAsync("node/1", onComplete) != RF24SN_INVALID_HANDLE);
+	run(gateway, node);
+	srand(7);
+	simSetLoss(300);
+	handled = 0;
+	handledValues.clear();
+	acked = 0;
+	for(int value = 100; value < 300; value++){
+		while(node.publishAsync(0, 1, value, 5, onComplete) == RF24SN_INVALID_HANDLE){
+			gateway.update();
+			node.update();
+		}
+	}
+	simSetLoss(0);
+	run(gateway, node);
+	SIM_CHECK(gateway.getStats().duplicates > 0);
+	SIM_CHECK(handled == handledValues.size());
+	SIM_CHECK(acked <= handled);
+	return 0;
+}
@@ -0,0 +1,74 @@
+// A receiver that lost the base of a delta encoded value does not ack it,
+// the retry carries the full value, so the value still arrives
+
+#include "RF24SN.h"
+#include "sim.h"
+
+#define DELTA_ENCODING RF24SN_VALUE_DECIMALS(RF24SN_VALUE_DELTA16, 1)
+
+static SimNode* receiver = NULL;
+static float lastValue = 0;
+static uint8_t received = 0;
+
+void onMessage(RF24SNMessage& message){
+	lastValue = message.packet.value;
+	received++;
+}
+
+// Runs the receiver while the sender waits in a blocking request
+void pumpReceiver(void){
+	receiver->node.update();
+}
+
+static bool asyncDone = false;
+static bool asyncSuccess = false;
+
+void onComplete(const RF24SNRequest& request, bool success, const void* response, uint16_t responseLength){
+	(void)request;
+	(void)response;
+	(void)responseLength;
+	asyncDone = true;
+	asyncSuccess = success;
+}
+
+int main(void){
+	receiver = new SimNode(0, onMessage);
+	SimNode client(1);
+	RF24SN& sender = client.node;
+	simSetPump(pumpReceiver);
+
+	// A full value, then a delta on it
+	SIM_CHECK(sender.publish(0, 1, 10.0f, 3, DELTA_ENCODING));
+	SIM_CHECK(sender.publish(0, 1, 10.5f, 3, DELTA_ENCODING) && lastValue == 10.5f);
+	SIM_CHECK(simCounters().types[RF24SN_PUBLISH_TYPED] == 2);
+
+	// The receiver restarts and forgets the base, the delta is dropped and the retry is a float publish
+	delete receiver;
+	receiver = new SimNode(0, onMessage);
+	simResetCounters();
+	received = 0;
+	SIM_CHECK(sender.publish(0, 1, 11.0f, 3, DELTA_ENCODING));
+	SIM_CHECK(received == 1 && lastValue == 11.0f);
+	SIM_CHECK(simCounters().types[RF24SN_PUBLISH_TYPED] == 1 && simCounters().types[RF24SN_PUBLISH] == 1);
+
+	// The next value is sent in full again, the one after that as a delta
+	SIM_CHECK(sender.publish(0, 1, 11.5f, 3, DELTA_ENCODING) && lastValue == 11.5f);
+	SIM_CHECK(sender.publish(0, 1, 12.0f, 3, DELTA_ENCODING) && lastValue == 12.0f);
+	SIM_CHECK(simCounters().types[RF24SN_PUBLISH_TYPED] == 3 && simCounters().types[RF24SN_PUBLISH] == 1);
+	simSetPump(NULL);
+
+	// The same with an asynchronous publish
+	delete receiver;
+	receiver = new SimNode(0, onMessage);
+	simResetCounters();
+	SIM_CHECK(sender.publishAsync(0, 1, 12.5f, 3, DELTA_ENCODING, onComplete) != RF24SN_INVALID_HANDLE);
+	for(uint16_t pass = 0; pass < 10000 && !asyncDone; pass++){
+		receiver->node.update();
+		sender.update();
+	}
+	SIM_CHECK(asyncDone && asyncSuccess && lastValue == 12.5f);
+	SIM_CHECK(simCounters().types[RF24SN_PUBLISH_TYPED] == 1 && simCounters().types[RF24SN_PUBLISH] == 1);
+
+	delete receiver;
+	return 0;
+}
@@ -0,0 +1,25 @@
+// Data written to the EEPROM storage is kept across a reboot, built for AVR and for
+// the ESP cores where the EEPROM is a RAM copy that must be committed to the flash
+
+#include "RF24SNStorage.h"
+#include "EEPROM.h"
+#include "sim.h"
+
+int main(void){
+	RF24SNEepromStorage storage(16, 32);
+	const uint8_t written[4] = {1, 2, 3, 4};
+	SIM_CHECK(storage.write(8, written, sizeof(written)));
+	for(uint8_t idx = 0; idx < sizeof(written); idx++){
+		SIM_CHECK(EEPROM.stored(16 + 8 + idx) == written[idx]);
+	}
+
+	uint8_t read[4] = {};
+	SIM_CHECK(storage.read(8, read, sizeof(read)));
+	SIM_CHECK(memcmp(read, written, sizeof(read)) == 0);
+
+	// Unchanged data and data past the end of the storage
+	SIM_CHECK(storage.write(8, written, sizeof(written)));
+	SIM_CHECK(!storage.write(30, written, sizeof(written)));
+	SIM_CHECK(!storage.read(30, read, sizeof(read)));
+	return 0;
+}
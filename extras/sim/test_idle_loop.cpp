@@ -0,0 +1,52 @@
+// A gateway whose request table is full sleeps in its event loop until a request
+// times out, instead of waking up for the values it can not send yet, and a loop
+// that could not be set up sleeps like with a polled radio instead of spinning
+
+#include "RF24SNGateway.h"
+#include "RF24SNEventLoop.h"
+#include "sim.h"
+
+#define LOOP_TIME 300
+
+int main(void){
+	SimGateway<> fixture;
+	RF24SNGateway& gateway = fixture.gateway;
+	RF24SNEventLoop loop;
+	SIM_CHECK(loop.begin(simRadioFd(&fixture.network)));
+	gateway.setIdle(&loop);
+	SimNode client(1);
+	RF24SN& node = client.node;
+
+	fixture.pump();
+	SIM_CHECK(node.subscribe("idle/topic") != (byte)RF24SN_RSP_FAILED);
+	simSetPump(NULL);
+
+	// The client stops answering, the probes fill the request table and a value waits behind them
+	for(uint8_t idx = 0; idx < RF24SN_MAX_PENDING_REQUESTS; idx++){
+		SIM_CHECK(gateway.pingAsync(1, NULL) != RF24SN_INVALID_HANDLE);
+	}
+	SIM_CHECK(gateway.pingAsync(1, NULL) == RF24SN_INVALID_HANDLE);
+	delay(RF24SN_ACK_DELAY + 1);
+	SIM_CHECK(gateway.checkSubscription("idle/topic", 1));
+
+	uint32_t updates = 0;
+	unsigned long start = millis();
+	while(millis() - start < LOOP_TIME){
+		gateway.update();
+		updates++;
+		loop.wait(gateway.getUpdateTimeout());
+	}
+	printf("%u updates in %u ms with a full request table\n", updates, LOOP_TIME);
+	SIM_CHECK(updates < LOOP_TIME / 5);
+
+	RF24SNEventLoop failedLoop;
+	uint32_t waits = 0;
+	start = millis();
+	while(millis() - start < LOOP_TIME){
+		failedLoop.wait(LOOP_TIME);
+		waits++;
+	}
+	printf("%u waits in %u ms without an event loop\n", waits, LOOP_TIME);
+	SIM_CHECK(waits <= LOOP_TIME * 1000 / RF24SN_RADIO_POLL_INTERVAL);
+	return 0;
+}
@@ -0,0 +1,50 @@
+// Values posted to a gateway are coalesced per topic when update() takes them,
+// only the newest value of each topic reaches the clients
+
+#include "RF24SNGateway.h"
+#include "sim.h"
+
+static float lastPlain = 0;
+static float lastFiltered = 0;
+static uint8_t plainValues = 0;
+static uint8_t filteredValues = 0;
+
+void onNodeMessage(RF24SNMessage& message){
+	if(message.packet.topicId == 1){
+		lastPlain = message.packet.value;
+		plainValues++;
+	}
+	else{
+		lastFiltered = message.packet.value;
+		filteredValues++;
+	}
+}
+
+int main(void){
+	SimGateway<> fixture;
+	SimNode client(1, onNodeMessage);
+	RF24SNGateway& gateway = fixture.gateway;
+	RF24SN& node = client.node;
+
+	fixture.pump();
+	SIM_CHECK(node.subscribe("ingress/plain") == 1);
+	SIM_CHECK(node.subscribe("ingress/+/filtered") == 2);
+	simSetPump(NULL);
+
+	for(uint8_t value = 1; value <= 10; value++){
+		SIM_CHECK(gateway.postSubscription("ingress/plain", value));
+		SIM_CHECK(gateway.postSubscription("ingress/a/filtered", value + 100));
+	}
+	SIM_CHECK(gateway.getIngressStats().posted == 20);
+	gateway.update();
+	SIM_CHECK(gateway.getIngressStats().coalesced == 9);
+
+	for(uint16_t pass = 0; pass < 1000 && (lastPlain != 10 || lastFiltered != 110); pass++){
+		gateway.update();
+		node.update();
+		delay(1);
+	}
+	SIM_CHECK(lastPlain == 10 && plainValues == 1);
+	SIM_CHECK(lastFiltered == 110 && filteredValues == 1);
+	return 0;
+}
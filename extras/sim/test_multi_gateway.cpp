@@ -0,0 +1,146 @@
+// Two radios share the upstream subscriptions: the subscribe handler runs once per
+// topic from update() on the broker thread, values reach the clients of both radios
+// and the unsubscribe handler runs once the clients of both radios are gone
+//
+// The radio threads run on the real time clock, every phase waits for the frames
+// of the clients or the handlers it expects instead of sleeping for a fixed time
+
+#include "RF24SNMultiGateway.h"
+#include "sim.h"
+
+#include <thread>
+#include <poll.h>
+#include <unistd.h>
+
+// Longest a phase may take, only reached when the test fails
+#define PHASE_LIMIT (RF24SN_CLIENT_INACTIVE_TIMEOUT * 5)
+
+// The broker has nothing to wait on, update() runs at least this often in ms
+#define BROKER_INTERVAL 10
+
+static std::thread::id brokerThread;
+static uint8_t subscribed = 0;
+static uint8_t unsubscribed = 0;
+static uint8_t received = 0;
+static bool wrongThread = false;
+
+void onMessage(uint8_t radio, RF24SNMessage& message){
+	(void)radio;
+	(void)message;
+}
+
+bool onSubscribe(const char* topic){
+	wrongThread |= std::this_thread::get_id() != brokerThread;
+	subscribed++;
+	return strncmp(topic, "deny/", 5) != 0;
+}
+
+void onUnsubscribe(const char* topic){
+	(void)topic;
+	wrongThread |= std::this_thread::get_id() != brokerThread;
+	unsubscribed++;
+}
+
+void onNodeMessage(RF24SNMessage& message){
+	if(message.packet.value == 5){
+		received++;
+	}
+}
+
+static bool valuesReceived(void){
+	return received >= 2;
+}
+
+static bool topicsLeft(void){
+	return unsubscribed >= 2;
+}
+
+// Runs the broker and the given clients until done() holds, woken up by the frames for
+// the clients, false if that took longer than PHASE_LIMIT
+static bool runUntil(RF24SNMultiGateway& multiGateway, SimNode** clients, uint8_t count, bool (*done)(void)){
+	struct pollfd fds[2];
+	for(uint8_t idx = 0; idx < count; idx++){
+		fds[idx].fd = simRadioFd(&clients[idx]->network);
+		fds[idx].events = POLLIN;
+	}
+	unsigned long start = millis();
+	while(!done()){
+		if(millis() - start > PHASE_LIMIT){
+			return false;
+		}
+		multiGateway.update();
+		uint32_t timeout = BROKER_INTERVAL;
+		for(uint8_t idx = 0; idx < count; idx++){
+			clients[idx]->node.update();
+			uint32_t nodeTimeout = clients[idx]->node.getUpdateTimeout();
+			timeout = nodeTimeout < timeout ? nodeTimeout : timeout;
+		}
+		if(poll(fds, count, timeout) > 0){
+			for(uint8_t idx = 0; idx < count; idx++){
+				uint64_t frames;
+				if((fds[idx].revents & POLLIN) && read(fds[idx].fd, &frames, sizeof(frames)) < 0){
+					// Another wake up drained it already
+				}
+			}
+		}
+	}
+	return true;
+}
+
+int main(void){
+	brokerThread = std::this_thread::get_id();
+	RF24 gatewayRadios[2];
+	RF24Network* gatewayNetworks[2];
+	RF24SNConfig gatewayConfigs[2];
+	SimNode* clients[2];
+	RF24SN* nodes[2];
+	RF24SNMultiGateway multiGateway(onMessage, onSubscribe);
+	multiGateway.setUnsubscribeHandler(onUnsubscribe);
+	for(uint8_t radio = 0; radio < 2; radio++){
+		uint8_t channel = 70 + radio * 5;
+		gatewayNetworks[radio] = new RF24Network(gatewayRadios[radio]);
+		gatewayConfigs[radio] = simConfig(0, channel);
+		SIM_CHECK(multiGateway.addRadio(&gatewayRadios[radio], gatewayNetworks[radio], &gatewayConfigs[radio]) == radio);
+	}
+	SIM_CHECK(multiGateway.begin());
+
+	// The radio threads ack the clients, the broker has not seen the topics yet
+	for(uint8_t radio = 0; radio < 2; radio++){
+		clients[radio] = new SimNode(1, onNodeMessage, 70 + radio * 5);
+		nodes[radio] = &clients[radio]->node;
+		SIM_CHECK(nodes[radio]->subscribe("shared/topic") != (byte)RF24SN_RSP_FAILED);
+	}
+	SIM_CHECK(nodes[1]->subscribe("shared/+") != (byte)RF24SN_RSP_FAILED);
+	SIM_CHECK(nodes[0]->subscribe("deny/topic") != (byte)RF24SN_RSP_FAILED);
+	SIM_CHECK(subscribed == 0);
+
+	multiGateway.update();
+	SIM_CHECK(subscribed == 3);
+	SIM_CHECK(multiGateway.checkSubscription("shared/topic", 5));
+	SIM_CHECK(multiGateway.checkSubscription("shared/other", 6));
+	SIM_CHECK(!multiGateway.checkSubscription("deny/topic", 7));
+	SIM_CHECK(!multiGateway.checkSubscription("other/topic", 8));
+
+	// A refused topic stays refused while a client is registered for it
+	SIM_CHECK(nodes[1]->subscribe("deny/topic") == (byte)RF24SN_RSP_FAILED);
+	multiGateway.update();
+	SIM_CHECK(subscribed == 3);
+
+	SIM_CHECK(runUntil(multiGateway, clients, 2, valuesReceived));
+	SIM_CHECK(received == 2);
+
+	// The silent clients are probed and removed, each topic is unsubscribed once
+	// The clients are not run, a frame of theirs would keep them registered
+	simSetNodeDown(1, true);
+	SIM_CHECK(runUntil(multiGateway, clients, 0, topicsLeft));
+	SIM_CHECK(unsubscribed == 2);
+	SIM_CHECK(!multiGateway.checkSubscription("shared/topic", 9));
+	SIM_CHECK(!wrongThread);
+
+	multiGateway.end();
+	for(uint8_t radio = 0; radio < 2; radio++){
+		delete clients[radio];
+		delete gatewayNetworks[radio];
+	}
+	return 0;
+}
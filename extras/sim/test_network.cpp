@@ -0,0 +1,80 @@
+// The simulated network itself: routing over the tree, latency, loss and nodes that are down
+
+#include "sim.h"
+#include "Arduino.h"
+
+static uint16_t send(RF24Network& from, uint16_t to, uint8_t value){
+	RF24NetworkHeader header(to, 'T');
+	return from.write(header, &value, sizeof(value));
+}
+
+static int receive(RF24Network& network){
+	RF24NetworkHeader header;
+	uint8_t value;
+	if(!network.available() || network.read(header, &value, sizeof(value)) != sizeof(value)){
+		return -1;
+	}
+	return value;
+}
+
+int main(void){
+	SIM_CHECK(simHops(00, 01) == 1);
+	SIM_CHECK(simHops(01, 00) == 1);
+	SIM_CHECK(simHops(011, 00) == 2);
+	SIM_CHECK(simHops(011, 01) == 1);
+	SIM_CHECK(simHops(011, 02) == 3);
+	SIM_CHECK(simHops(011, 021) == 2);
+	SIM_CHECK(simHops(011, 022) == 4);
+	SIM_CHECK(simHops(0111, 011) == 1);
+
+	RF24 radios[4];
+	RF24Network master(radios[0]), child(radios[1]), grandchild(radios[2]), otherChannel(radios[3]);
+	master.begin(90, 00);
+	child.begin(90, 01);
+	grandchild.begin(90, 011);
+	otherChannel.begin(80, 02);
+
+	// Latency per hop, the header carries the sender
+	simSetLatency(5);
+	SIM_CHECK(send(grandchild, 00, 1));
+	SIM_CHECK(send(child, 00, 2));
+	simAdvance(5);
+	RF24NetworkHeader header;
+	SIM_CHECK(master.peek(header) == 1 && header.from_node == 01 && header.type == 'T');
+	SIM_CHECK(receive(master) == 2);
+	SIM_CHECK(receive(master) == -1);
+	simAdvance(5);
+	SIM_CHECK(receive(master) == 1);
+
+	// Nodes on another channel, down or powered down do not ack
+	simSetLatency(0);
+	SIM_CHECK(!send(master, 02, 3));
+	simSetNodeDown(01, true);
+	SIM_CHECK(!send(master, 01, 4));
+	simSetNodeDown(01, false);
+	radios[1].powerDown();
+	SIM_CHECK(!send(master, 01, 5));
+	radios[1].powerUp();
+	SIM_CHECK(send(master, 01, 6) && receive(child) == 6);
+
+	// Loss per hop, lost frames were still acked
+	srand(1);
+	simSetLoss(100);
+	simResetCounters();
+	uint16_t received = 0;
+	for(uint16_t idx = 0; idx < 1000; idx++){
+		SIM_CHECK(send(master, 011, idx));
+		received += receive(grandchild) >= 0;
+	}
+	SIM_CHECK(simCounters().writes == 1000 && simCounters().lost == 1000u - received);
+	// 0.9 * 0.9 of the frames make it over 2 hops
+	SIM_CHECK(received > 770 && received < 850);
+
+	// The virtual clock only moves when asked to
+	simSetUpdateTime(3);
+	unsigned long now = millis();
+	master.update();
+	delay(7);
+	SIM_CHECK(millis() - now == 10);
+	return 0;
+}
@@ -0,0 +1,78 @@
+// A dead client that is probed and still has a value queued must not hold every
+// request slot, the other clients keep getting their values in time
+
+#include "RF24SNGateway.h"
+#include "sim.h"
+
+#define LIVE_CLIENTS 3
+#define VALUE_INTERVAL 100
+#define VALUES 50
+#define MAX_LATENCY 500
+
+typedef RF24SNGatewayT<LIVE_CLIENTS + 1, 2> ProbeGateway;
+
+static unsigned long publishedAt[VALUES];
+static unsigned long maxLatency = 0;
+static uint8_t lastValue[LIVE_CLIENTS + 2];
+
+static uint16_t currentNode = 0;
+
+void onNodeMessage(RF24SNMessage& message){
+	uint8_t value = (uint8_t)message.packet.value;
+	unsigned long latency = millis() - publishedAt[value];
+	maxLatency = latency > maxLatency ? latency : maxLatency;
+	lastValue[currentNode] = value;
+}
+
+int main(void){
+	SimGateway<ProbeGateway> fixture;
+	ProbeGateway* gateway = &fixture.gateway;
+
+	// Node 1 registers first and dies, it is the first one to be probed
+	SimNode* clients[LIVE_CLIENTS + 1];
+	RF24SN* nodes[LIVE_CLIENTS + 1];
+	fixture.pump();
+	for(uint8_t idx = 0; idx <= LIVE_CLIENTS; idx++){
+		clients[idx] = new SimNode(idx + 1, onNodeMessage);
+		nodes[idx] = &clients[idx]->node;
+		SIM_CHECK(nodes[idx]->subscribe("probe/value") != (byte)RF24SN_RSP_FAILED);
+	}
+	simSetPump(NULL);
+	simSetNodeDown(1, true);
+
+	// All clients are quiet until they are probed
+	unsigned long start = millis();
+	while(millis() - start < RF24SN_CLIENT_PROBE_TIMEOUT + RF24SN_CLIENT_INACTIVE_DELAY){
+		gateway->update();
+		for(uint8_t idx = 1; idx <= LIVE_CLIENTS; idx++){
+			currentNode = idx + 1;
+			nodes[idx]->update();
+		}
+	}
+
+	uint8_t published = 0;
+	unsigned long nextValue = millis();
+	unsigned long end = nextValue + VALUES * VALUE_INTERVAL + MAX_LATENCY;
+	while((long)(millis() - end) < 0){
+		if(published < VALUES && (long)(millis() - nextValue) >= 0){
+			publishedAt[published] = millis();
+			gateway->checkSubscription("probe/value", published++);
+			nextValue += VALUE_INTERVAL;
+		}
+		gateway->update();
+		for(uint8_t idx = 1; idx <= LIVE_CLIENTS; idx++){
+			currentNode = idx + 1;
+			nodes[idx]->update();
+		}
+	}
+	printf("live clients got their values within %lu ms\n", maxLatency);
+	SIM_CHECK(maxLatency < MAX_LATENCY);
+	for(uint8_t idx = 1; idx <= LIVE_CLIENTS; idx++){
+		SIM_CHECK(lastValue[idx + 1] == VALUES - 1);
+	}
+
+	for(uint8_t idx = 0; idx <= LIVE_CLIENTS; idx++){
+		delete clients[idx];
+	}
+	return 0;
+}
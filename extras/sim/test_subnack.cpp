@@ -0,0 +1,69 @@
+// A topic the gateway refuses, or a client it has no room for, is answered with a
+// SUBNACK, the client gives up after the first transmission instead of repeating the subscribe
+
+#include "RF24SNGateway.h"
+#include "sim.h"
+
+static uint8_t completed = 0;
+static bool succeeded = false;
+
+bool onSubscribe(const char* topic){
+	return strncmp(topic, "deny/", 5) != 0;
+}
+
+void onComplete(const RF24SNRequest& request, bool success, const void* response, uint16_t responseLength){
+	(void)request;
+	(void)response;
+	(void)responseLength;
+	completed++;
+	succeeded = success;
+}
+
+int main(void){
+	SimGateway<> fixture(simIgnoreMessage, onSubscribe);
+	SimNode client(1);
+	RF24SNGateway& gateway = fixture.gateway;
+	RF24SN& node = client.node;
+
+	fixture.pump();
+	SIM_CHECK(node.subscribe("allow/1") != (byte)RF24SN_RSP_FAILED);
+	simResetCounters();
+	unsigned long start = millis();
+	SIM_CHECK(node.subscribe("deny/1") == (byte)RF24SN_RSP_FAILED);
+	SIM_CHECK(simCounters().types[RF24SN_SUBSCRIBE] == 1);
+	SIM_CHECK(simCounters().types[RF24SN_SUBNACK] == 1);
+	SIM_CHECK(millis() - start < RF24SN_INITIAL_RTO);
+	simSetPump(NULL);
+
+	simResetCounters();
+	SIM_CHECK(node.subscribeAsync("deny/2", onComplete) != RF24SN_INVALID_HANDLE);
+	for(uint16_t pass = 0; pass < 1000 && completed == 0; pass++){
+		gateway.update();
+		node.update();
+	}
+	SIM_CHECK(completed == 1 && !succeeded);
+	SIM_CHECK(simCounters().types[RF24SN_SUBSCRIBE] == 1);
+
+	// An empty name in a bulk subscribe fails on its own, the other names keep their position
+	fixture.pump();
+	const char* const topics[] = {"many/a", "", "allow/1"};
+	byte topicIds[3];
+	SIM_CHECK(node.subscribeMany(topics, 3, topicIds));
+	SIM_CHECK(topicIds[0] != (byte)RF24SN_RSP_FAILED && topicIds[1] == (byte)RF24SN_RSP_FAILED);
+	SIM_CHECK(topicIds[2] != (byte)RF24SN_RSP_FAILED);
+
+	// A client that does not fit in the client table is refused on the first transmission
+	SimNode other(2), last(3);
+	RF24SN& otherNode = other.node;
+	RF24SN& lastNode = last.node;
+	SIM_CHECK(otherNode.subscribe("allow/2") != (byte)RF24SN_RSP_FAILED);
+	simResetCounters();
+	start = millis();
+	SIM_CHECK(lastNode.subscribe("allow/3") == (byte)RF24SN_RSP_FAILED);
+	SIM_CHECK(!lastNode.subscribeMany(topics, 1, topicIds) && topicIds[0] == (byte)RF24SN_RSP_FAILED);
+	SIM_CHECK(simCounters().types[RF24SN_SUBSCRIBE] == 1 && simCounters().types[RF24SN_SUBSCRIBE_MANY] == 1);
+	SIM_CHECK(simCounters().types[RF24SN_SUBNACK] == 2);
+	SIM_CHECK(millis() - start < RF24SN_INITIAL_RTO);
+	simSetPump(NULL);
+	return 0;
+}
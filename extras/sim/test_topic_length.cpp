@@ -0,0 +1,42 @@
+// Topic names must leave room for their terminator in the 20 byte subscribe request
+
+#include "RF24SNGateway.h"
+#include "sim.h"
+
+static char subscribedTopic[RF24SN_TOPIC_LENGTH + 1];
+static uint8_t completed = 0;
+
+bool onSubscribe(const char* topic){
+	strcpy(subscribedTopic, topic);
+	return true;
+}
+
+void onComplete(const RF24SNRequest& request, bool success, const void* response, uint16_t responseLength){
+	(void)request;
+	(void)response;
+	(void)responseLength;
+	completed += success;
+}
+
+int main(void){
+	SimGateway<> fixture(simIgnoreMessage, onSubscribe);
+	SimNode client(1);
+	RF24SNGateway& gateway = fixture.gateway;
+	RF24SN& node = client.node;
+
+	const char* tooLong = "01234567890123456789";
+	const char* longest = "0123456789012345678";
+	SIM_CHECK(strlen(tooLong) == RF24SN_TOPIC_LENGTH);
+	SIM_CHECK(node.subscribeAsync(tooLong, onComplete) == RF24SN_INVALID_HANDLE);
+	SIM_CHECK(node.subscribe(tooLong) == (byte)RF24SN_RSP_FAILED);
+	SIM_CHECK(simCounters().writes == 0);
+
+	SIM_CHECK(node.subscribeAsync(longest, onComplete) != RF24SN_INVALID_HANDLE);
+	for(uint16_t pass = 0; pass < 100 && completed == 0; pass++){
+		gateway.update();
+		node.update();
+	}
+	SIM_CHECK(completed == 1);
+	SIM_CHECK(strcmp(subscribedTopic, longest) == 0);
+	return 0;
+}